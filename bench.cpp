@@ -0,0 +1,398 @@
+/*
+ * xbiso-bench - performance measurements for xbiso
+ * Copyright (C) 2015 Stefan Schmidt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*/
+
+#include "xdvdfs.hpp"
+#include "pathindex.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+/**
+ * The result of a benchmark. Counters that don't apply are zero.
+*/
+struct Result
+{
+    std::string name;
+    std::string variant;
+    double seconds;
+    uint64_t bytes;
+    uint64_t items;
+    uint64_t readCalls;
+    uint64_t writeCalls;
+};
+
+struct IoCounters
+{
+    uint64_t readCalls;
+    uint64_t writeCalls;
+};
+
+/**
+ * Reads the number of read and write system calls of the process. This is
+ * only available on Linux, elsewhere the counters stay zero.
+*/
+static IoCounters ioCounters ()
+{
+    IoCounters counters = {0, 0};
+
+    std::FILE* f = std::fopen("/proc/self/io", "r");
+    if (!f)
+        return counters;
+
+    char name[32];
+    unsigned long long value;
+    while (std::fscanf(f, "%31[^:]: %llu\n", name, &value) == 2)
+    {
+        if (std::strcmp(name, "syscr") == 0)
+            counters.readCalls = value;
+        else if (std::strcmp(name, "syscw") == 0)
+            counters.writeCalls = value;
+    }
+
+    std::fclose(f);
+    return counters;
+}
+
+/**
+ * Runs a benchmark the given number of times and keeps the fastest run. The
+ * function returns the number of bytes and items it processed.
+*/
+template<typename F>
+static Result measure (const std::string& name, const std::string& variant, int repetitions, F function)
+{
+    Result best;
+    best.name = name;
+    best.variant = variant;
+    best.seconds = -1;
+
+    for (int i=0; i<repetitions; ++i)
+    {
+        IoCounters before = ioCounters();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::pair<uint64_t, uint64_t> processed = function();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        IoCounters after = ioCounters();
+
+        if (best.seconds < 0 || seconds < best.seconds)
+        {
+            best.seconds = seconds;
+            best.bytes = processed.first;
+            best.items = processed.second;
+            best.readCalls = after.readCalls - before.readCalls;
+            best.writeCalls = after.writeCalls - before.writeCalls;
+        }
+    }
+
+    return best;
+}
+
+static void openImage (std::ifstream& file, const std::string& filename)
+{
+    file.open(filename.c_str(), file.binary | file.in);
+    if (!file.is_open())
+    {
+        std::cerr << "ERROR: Could not open file '" << filename << "'" << std::endl;
+        std::exit(1);
+    }
+
+    file.exceptions(file.failbit | file.badbit | file.eofbit);
+}
+
+/**
+ * Resolves a path by descending the directory tables one component at a time.
+*/
+static bool lookup (std::ifstream& file, xdvdfs::DirectoryEntry root, const std::string& path)
+{
+    xdvdfs::DirectoryEntry dirent = root;
+    std::size_t start = 0;
+
+    while (true)
+    {
+        std::size_t end = path.find('/', start);
+        if (!dirent.findEntry(file, path.substr(start, end == std::string::npos ? std::string::npos : end-start), dirent))
+            return false;
+
+        if (end == std::string::npos)
+            return true;
+
+        dirent = dirent.getFirstEntry(file);
+        start = end + 1;
+    }
+}
+
+/**
+ * Counts the entries below a directory table by decoding every table in bulk,
+ * reusing one table per depth.
+*/
+static uint64_t scanTables (std::ifstream& file, std::vector<xdvdfs::DirectoryTable>& tables, std::size_t depth, uint32_t sector, uint32_t size)
+{
+    if (tables.size() <= depth)
+        tables.resize(depth + 1);
+
+    tables[depth].read(file, sector, size);
+    uint64_t count = tables[depth].size();
+
+    for (std::size_t i=0; i<tables[depth].size(); ++i)
+    {
+        if (tables[depth].isDirectory(i))
+            count += scanTables(file, tables, depth + 1, tables[depth].sectors[i], tables[depth].sizes[i]);
+    }
+
+    return count;
+}
+
+static void printResults (const std::vector<Result>& results, bool json)
+{
+    for (std::size_t i=0; i<results.size(); ++i)
+    {
+        const Result& r = results[i];
+        double mbps = r.seconds > 0 ? r.bytes / r.seconds / (1024.0*1024.0) : 0;
+        double itemsps = r.seconds > 0 ? r.items / r.seconds : 0;
+
+        if (json)
+        {
+            std::printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"seconds\":%.6f,\"bytes\":%llu,\"items\":%llu,"
+                        "\"mb_per_s\":%.3f,\"items_per_s\":%.1f,\"read_calls\":%llu,\"write_calls\":%llu}\n",
+                        r.name.c_str(), r.variant.c_str(), r.seconds,
+                        static_cast<unsigned long long>(r.bytes), static_cast<unsigned long long>(r.items),
+                        mbps, itemsps,
+                        static_cast<unsigned long long>(r.readCalls), static_cast<unsigned long long>(r.writeCalls));
+        }
+        else
+        {
+            std::printf("%-20s %-16s %10.6f s %10.1f MB/s %12.0f items/s %10llu reads %10llu writes\n",
+                        r.name.c_str(), r.variant.c_str(), r.seconds, mbps, itemsps,
+                        static_cast<unsigned long long>(r.readCalls), static_cast<unsigned long long>(r.writeCalls));
+        }
+    }
+}
+
+static void printUsage ()
+{
+    std::cout << "Usage: xbiso-bench [options] image\n"
+              << "Options:\n"
+              << "  -r <n>      Repeat every benchmark <n> times and keep the fastest run\n"
+              << "  -o <dir>    Write extracted files to <dir> instead of discarding them\n"
+              << "  --json      Print one JSON object per result\n"
+              << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+    int repetitions = 3;
+    bool json = false;
+    std::string output;
+    std::string filename;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "-r" && i+1 < argc)
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-o" && i+1 < argc)
+            output = argv[++i];
+        else if (arg == "--json")
+            json = true;
+        else if (arg[0] != '-' && filename.empty())
+            filename = arg;
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (filename.empty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::ifstream file;
+    openImage(file, filename);
+
+    std::vector<Result> results;
+    xdvdfs::VolumeDescriptor vd;
+
+    try
+    {
+        results.push_back(measure("volume-descriptor", "ifstream", repetitions, [&] {
+            const int runs = 1000;
+            for (int i=0; i<runs; ++i)
+            {
+                vd.readFromFile(file);
+                vd.validate();
+            }
+            return std::pair<uint64_t, uint64_t>(runs * xdvdfs::SECTOR_SIZE, runs);
+        }));
+
+        xdvdfs::DirectoryEntry root = vd.getRootDirEntry(file);
+        std::vector<xdvdfs::TreeEntry> entries;
+
+        results.push_back(measure("traversal", "ifstream", repetitions, [&] {
+            entries.clear();
+            xdvdfs::listTree(file, root, entries);
+            return std::pair<uint64_t, uint64_t>(0, entries.size());
+        }));
+
+        xdvdfs::TreeWalker walker;
+
+        results.push_back(measure("traversal", "visitor", repetitions, [&] {
+            uint64_t count = 0;
+            walker.walk(file, vd, [&count] (const xdvdfs::EntryView&) {
+                ++count;
+                return true;
+            });
+            return std::pair<uint64_t, uint64_t>(0, count);
+        }));
+
+        std::vector<xdvdfs::DirectoryTable> tables;
+
+        results.push_back(measure("traversal", "bulk", repetitions, [&] {
+            uint64_t count = scanTables(file, tables, 0, vd.getRootDirTableSector(), vd.getRootDirTableSize());
+            return std::pair<uint64_t, uint64_t>(0, count);
+        }));
+
+        results.push_back(measure("lookup", "ifstream", repetitions, [&] {
+            for (std::size_t i=0; i<entries.size(); ++i)
+            {
+                if (!lookup(file, root, entries[i].path))
+                    throw new xdvdfs::Exception("Lookup of an existing path failed");
+            }
+            return std::pair<uint64_t, uint64_t>(0, entries.size());
+        }));
+
+        xdvdfs::PathIndex index;
+
+        results.push_back(measure("index-build", "1 thread", repetitions, [&] {
+            index.build(filename, 1);
+            return std::pair<uint64_t, uint64_t>(0, index.size());
+        }));
+
+        unsigned int threads = std::thread::hardware_concurrency();
+        if (threads > 1)
+        {
+            results.push_back(measure("index-build", std::to_string(threads) + " threads", repetitions, [&] {
+                index.build(filename, threads);
+                return std::pair<uint64_t, uint64_t>(0, index.size());
+            }));
+        }
+
+        results.push_back(measure("lookup", "index", repetitions, [&] {
+            for (std::size_t i=0; i<entries.size(); ++i)
+            {
+                if (!index.find(entries[i].path))
+                    throw new xdvdfs::Exception("Lookup of an existing path failed");
+            }
+            return std::pair<uint64_t, uint64_t>(0, entries.size());
+        }));
+
+        std::vector<xdvdfs::TreeEntry*> files;
+        for (std::size_t i=0; i<entries.size(); ++i)
+        {
+            if (!entries[i].dirent.isDirectory())
+                files.push_back(&entries[i]);
+        }
+
+        const std::size_t bufferSizes[] = {4096, 64*1024, 1024*1024};
+
+        for (std::size_t b=0; b<sizeof(bufferSizes)/sizeof(bufferSizes[0]); ++b)
+        {
+            std::size_t bufferSize = bufferSizes[b];
+            std::string variant = std::to_string(bufferSize / 1024) + "K";
+
+            results.push_back(measure("extract-ifstream", variant, repetitions, [&] {
+                uint64_t bytes = 0;
+                for (std::size_t i=0; i<files.size(); ++i)
+                {
+                    std::ofstream ofile;
+                    if (!output.empty())
+                        ofile.open((output + "/" + std::to_string(i)).c_str(), ofile.out | ofile.binary | ofile.trunc);
+
+                    files[i]->dirent.readData(file, [&] (const char* data, std::size_t length) {
+                        if (ofile.is_open())
+                            ofile.write(data, length);
+                        bytes += length;
+                    }, bufferSize);
+                }
+                return std::pair<uint64_t, uint64_t>(bytes, files.size());
+            }));
+
+#if !defined _WIN32
+            // positional reads on a plain descriptor, bypassing the stream buffer
+            results.push_back(measure("extract-pread", variant, repetitions, [&] {
+                int fd = open(filename.c_str(), O_RDONLY);
+                std::vector<char> buffer(bufferSize);
+                uint64_t bytes = 0;
+
+                for (std::size_t i=0; i<files.size(); ++i)
+                {
+                    int ofd = -1;
+                    if (!output.empty())
+                        ofd = open((output + "/" + std::to_string(i)).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                    off_t offset = static_cast<off_t>(files[i]->dirent.getStartSector()) * xdvdfs::SECTOR_SIZE;
+                    uint64_t remaining = files[i]->dirent.getFileSize();
+
+                    while (remaining > 0)
+                    {
+                        ssize_t r = pread(fd, buffer.data(), std::min<uint64_t>(remaining, bufferSize), offset);
+                        if (r <= 0)
+                            throw new xdvdfs::Exception("Reading the image failed");
+
+                        if (ofd >= 0 && write(ofd, buffer.data(), r) != r)
+                            throw new xdvdfs::Exception("Writing the output failed");
+
+                        offset += r;
+                        remaining -= r;
+                        bytes += r;
+                    }
+
+                    if (ofd >= 0)
+                        close(ofd);
+                }
+
+                close(fd);
+                return std::pair<uint64_t, uint64_t>(bytes, files.size());
+            }));
+#endif
+        }
+    }
+    catch (xdvdfs::Exception* e)
+    {
+        std::cerr << "ERROR: " << e->what() << std::endl;
+        delete e;
+        return 1;
+    }
+
+    printResults(results, json);
+    return 0;
+}
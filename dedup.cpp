@@ -0,0 +1,144 @@
+#include "dedup.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <set>
+
+#if defined _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/ioctl.h>
+    #if defined __linux__
+        #include <linux/fs.h>
+    #endif
+#endif
+
+void Deduplicator::setMethod (Deduplicator::Method method, bool compareContents)
+{
+    this->method = method;
+    this->compareContents = compareContents;
+}
+
+/**
+ * Forgets the files of the previous image. When contents are compared, the
+ * data of all files that share their size with a file at a different extent is
+ * hashed up front, so duplicates are known before anything gets written.
+*/
+void Deduplicator::prepare (std::ifstream& file, std::vector<xdvdfs::TreeEntry>& entries)
+{
+    this->targets.clear();
+    this->contentKeys.clear();
+
+    if (!this->compareContents)
+        return;
+
+    typedef std::pair<uint32_t, uint32_t> Extent;
+    std::set<Extent> extents;
+    std::map<uint32_t, unsigned int> extentsBySize;     ///< number of distinct extents of each size
+
+    for (std::size_t i=0; i<entries.size(); ++i)
+    {
+        xdvdfs::DirectoryEntry& dirent = entries[i].dirent;
+        if (dirent.isDirectory() || dirent.getFileSize() == 0)
+            continue;
+
+        Extent extent(dirent.getStartSector(), dirent.getFileSize());
+        if (extents.insert(extent).second)
+            ++extentsBySize[extent.second];
+    }
+
+    for (std::size_t i=0; i<entries.size(); ++i)
+    {
+        xdvdfs::DirectoryEntry& dirent = entries[i].dirent;
+        if (dirent.isDirectory() || dirent.getFileSize() == 0)
+            continue;
+
+        Extent extent(dirent.getStartSector(), dirent.getFileSize());
+        if (extentsBySize[extent.second] < 2 || this->contentKeys.count(extent))
+            continue;
+
+        hash::Sha1 sha1;
+        dirent.readData(file, [&sha1] (const char* data, std::size_t length) {
+            sha1.update(data, length);
+        });
+
+        this->contentKeys[extent] = sha1.hexdigest();
+    }
+}
+
+std::string Deduplicator::key (xdvdfs::DirectoryEntry& dirent) const
+{
+    std::pair<uint32_t, uint32_t> extent(dirent.getStartSector(), dirent.getFileSize());
+    std::map<std::pair<uint32_t, uint32_t>, std::string>::const_iterator it = this->contentKeys.find(extent);
+
+    if (it != this->contentKeys.end())
+        return std::to_string(extent.second) + ":" + it->second;
+
+    return std::to_string(extent.second) + "@" + std::to_string(extent.first);
+}
+
+const Deduplicator::Target* Deduplicator::find (xdvdfs::DirectoryEntry& dirent) const
+{
+    if (this->method == OFF || dirent.getFileSize() == 0)
+        return nullptr;
+
+    std::map<std::string, Target>::const_iterator it = this->targets.find(this->key(dirent));
+    return it == this->targets.end() ? nullptr : &it->second;
+}
+
+void Deduplicator::remember (xdvdfs::DirectoryEntry& dirent, const Deduplicator::Target& target)
+{
+    if (this->method == OFF || dirent.getFileSize() == 0)
+        return;
+
+    std::string k = this->key(dirent);
+    if (!this->targets.count(k))
+        this->targets[k] = target;
+}
+
+/**
+ * Creates the destination as a hardlink or reflink of the source. Returns
+ * false if the filesystem doesn't support it, the file has to be written then.
+*/
+bool Deduplicator::link (const std::string& source, const std::string& destination) const
+{
+    std::remove(destination.c_str());
+
+#if defined _WIN32
+    if (this->method == HARDLINK)
+        return CreateHardLinkA(destination.c_str(), source.c_str(), NULL) != 0;
+
+    return false;
+#else
+    if (this->method == HARDLINK)
+        return ::link(source.c_str(), destination.c_str()) == 0;
+
+    #if defined FICLONE
+        int src = open(source.c_str(), O_RDONLY);
+        if (src < 0)
+            return false;
+
+        int dst = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (dst < 0)
+        {
+            close(src);
+            return false;
+        }
+
+        bool cloned = ioctl(dst, FICLONE, src) == 0;
+        close(src);
+        close(dst);
+
+        if (!cloned)
+            std::remove(destination.c_str());
+
+        return cloned;
+    #else
+        return false;
+    #endif
+#endif
+}
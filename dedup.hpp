@@ -0,0 +1,43 @@
+#pragma once
+
+#include "xdvdfs.hpp"
+#include "verify.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * This class detects files whose data has already been extracted, either
+ * because their directory entries share the same extent or, optionally,
+ * because their contents are identical, and links them to the first copy.
+*/
+class Deduplicator
+{
+    public:
+        enum Method {OFF, HARDLINK, REFLINK};
+
+        struct Target
+        {
+            std::string filename;
+            verify::Result hashes;      ///< only filled when hashing is enabled
+        };
+
+        Deduplicator () : method(OFF), compareContents(false) {}
+
+        void setMethod (Method method, bool compareContents);
+        bool isEnabled () const { return this->method != OFF; }
+
+        void prepare (std::ifstream& file, std::vector<xdvdfs::TreeEntry>& entries);
+        const Target* find (xdvdfs::DirectoryEntry& dirent) const;
+        void remember (xdvdfs::DirectoryEntry& dirent, const Target& target);
+        bool link (const std::string& source, const std::string& destination) const;
+
+    private:
+        std::string key (xdvdfs::DirectoryEntry& dirent) const;
+
+        Method method;
+        bool compareContents;
+        std::map<std::pair<uint32_t, uint32_t>, std::string> contentKeys;  ///< content hash by extent
+        std::map<std::string, Target> targets;
+};
@@ -0,0 +1,211 @@
+#include "diff.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+    const std::size_t COMPARE_BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * The state of comparing two images, with one decoded table per depth
+     * and image, reused for all directories at that depth.
+    */
+    struct Comparison
+    {
+        std::ifstream* files[2];
+        std::vector<xdvdfs::DirectoryTable> tables[2];
+        std::vector<std::vector<std::size_t> > orders[2];    ///< entries sorted by name
+        std::vector<char> buffers[2];
+        diff::ContentMode mode;
+        const diff::Reporter* reporter;
+    };
+
+    /**
+     * Decodes a directory table and sorts its entries by name. The table is
+     * a search tree, but sorting the decoded entries doesn't depend on it
+     * being well-formed.
+    */
+    void loadDirectory (Comparison& c, int side, std::size_t depth, uint32_t sector, uint32_t size)
+    {
+        if (c.tables[side].size() <= depth)
+        {
+            c.tables[side].resize(depth + 1);
+            c.orders[side].resize(depth + 1);
+        }
+
+        xdvdfs::DirectoryTable& table = c.tables[side][depth];
+        table.read(*c.files[side], sector, size);
+
+        std::vector<std::size_t>& order = c.orders[side][depth];
+        order.resize(table.size());
+        for (std::size_t i=0; i<order.size(); ++i)
+            order[i] = i;
+
+        std::sort(order.begin(), order.end(), [&table] (std::size_t a, std::size_t b) {
+            return xdvdfs::compareFilenames(table.name(a), table.name(b)) < 0;
+        });
+    }
+
+    /**
+     * Reports an entry that only exists in one of the images, including
+     * everything below it if it's a directory.
+    */
+    void reportSubtree (Comparison& c, int side, uint32_t sector, uint32_t size, const std::string& prefix)
+    {
+        diff::Change change = side == 0 ? diff::REMOVED : diff::ADDED;
+        xdvdfs::TreeWalker walker;
+
+        walker.walk(*c.files[side], sector, size, [&] (const xdvdfs::EntryView& entry) {
+            (*c.reporter)(change, prefix + entry.path.str() + (entry.isDirectory() ? "/" : ""));
+            return true;
+        });
+    }
+
+    void reportEntry (Comparison& c, int side, std::size_t depth, std::size_t i, const std::string& path)
+    {
+        xdvdfs::DirectoryTable& table = c.tables[side][depth];
+        diff::Change change = side == 0 ? diff::REMOVED : diff::ADDED;
+
+        if (!table.isDirectory(i))
+        {
+            (*c.reporter)(change, path);
+            return;
+        }
+
+        (*c.reporter)(change, path + "/");
+        reportSubtree(c, side, table.sectors[i], table.sizes[i], path + "/");
+    }
+
+    /**
+     * Compares the data of two files of the same size, stopping at the first
+     * difference.
+    */
+    bool sameContents (Comparison& c, uint32_t oldSector, uint32_t newSector, uint32_t size)
+    {
+        c.files[0]->seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * oldSector, std::ios::beg);
+        c.files[1]->seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * newSector, std::ios::beg);
+
+        for (int side=0; side<2; ++side)
+            c.buffers[side].resize(COMPARE_BUFFER_SIZE);
+
+        while (size > 0)
+        {
+            std::size_t length = std::min<std::size_t>(size, COMPARE_BUFFER_SIZE);
+
+            c.files[0]->read(c.buffers[0].data(), length);
+            c.files[1]->read(c.buffers[1].data(), length);
+
+            if (std::memcmp(c.buffers[0].data(), c.buffers[1].data(), length) != 0)
+                return false;
+
+            size -= length;
+        }
+
+        return true;
+    }
+
+    /**
+     * Merges the sorted entries of a directory in both images. Files are
+     * compared by size first; only files whose extents differ have to be
+     * read at all.
+    */
+    void compareDirectories (Comparison& c, std::size_t depth, const uint32_t sectors[2], const uint32_t sizes[2], const std::string& prefix)
+    {
+        for (int side=0; side<2; ++side)
+            loadDirectory(c, side, depth, sectors[side], sizes[side]);
+
+        std::size_t o = 0, n = 0;
+
+        while (o < c.orders[0][depth].size() || n < c.orders[1][depth].size())
+        {
+            // descending may grow the vectors of tables, so the references are taken anew
+            xdvdfs::DirectoryTable& oldTable = c.tables[0][depth];
+            xdvdfs::DirectoryTable& newTable = c.tables[1][depth];
+            const std::vector<std::size_t>& oldOrder = c.orders[0][depth];
+            const std::vector<std::size_t>& newOrder = c.orders[1][depth];
+
+            int cmp;
+            if (o == oldOrder.size())
+                cmp = 1;
+            else if (n == newOrder.size())
+                cmp = -1;
+            else
+                cmp = xdvdfs::compareFilenames(oldTable.name(oldOrder[o]), newTable.name(newOrder[n]));
+
+            if (cmp < 0)
+            {
+                std::size_t i = oldOrder[o++];
+                reportEntry(c, 0, depth, i, prefix + oldTable.name(i).str());
+                continue;
+            }
+
+            if (cmp > 0)
+            {
+                std::size_t i = newOrder[n++];
+                reportEntry(c, 1, depth, i, prefix + newTable.name(i).str());
+                continue;
+            }
+
+            std::size_t i = oldOrder[o++];
+            std::size_t j = newOrder[n++];
+            std::string path = prefix + newTable.name(j).str();
+            bool oldIsDirectory = oldTable.isDirectory(i);
+            bool newIsDirectory = newTable.isDirectory(j);
+
+            if (oldIsDirectory != newIsDirectory)
+            {
+                reportEntry(c, 0, depth, i, path);
+                reportEntry(c, 1, depth, j, path);
+            }
+            else if (oldIsDirectory)
+            {
+                uint32_t childSectors[2] = {oldTable.sectors[i], newTable.sectors[j]};
+                uint32_t childSizes[2] = {oldTable.sizes[i], newTable.sizes[j]};
+
+                if (childSizes[0] == 0 || childSizes[1] == 0)
+                {
+                    // one of them is empty, so everything in the other one changed
+                    if (childSizes[0] > 0)
+                        reportSubtree(c, 0, childSectors[0], childSizes[0], path + "/");
+                    if (childSizes[1] > 0)
+                        reportSubtree(c, 1, childSectors[1], childSizes[1], path + "/");
+                }
+                else
+                {
+                    compareDirectories(c, depth + 1, childSectors, childSizes, path + "/");
+                }
+            }
+            else if (oldTable.sizes[i] != newTable.sizes[j])
+            {
+                (*c.reporter)(diff::MODIFIED, path);
+            }
+            else if (c.mode == diff::CONTENT_ALL || oldTable.sectors[i] != newTable.sectors[j])
+            {
+                if (!sameContents(c, oldTable.sectors[i], newTable.sectors[j], oldTable.sizes[i]))
+                    (*c.reporter)(diff::MODIFIED, path);
+            }
+        }
+    }
+}
+
+/**
+ * Compares the trees of two images by walking both in sorted order at the
+ * same time, and reports every entry that was added, removed or modified.
+ * Directories that were added or removed are reported with a trailing '/'.
+*/
+void diff::compareImages (std::ifstream& oldFile, xdvdfs::VolumeDescriptor& oldVd,
+                          std::ifstream& newFile, xdvdfs::VolumeDescriptor& newVd,
+                          diff::ContentMode mode, const diff::Reporter& reporter)
+{
+    Comparison c;
+    c.files[0] = &oldFile;
+    c.files[1] = &newFile;
+    c.mode = mode;
+    c.reporter = &reporter;
+
+    uint32_t sectors[2] = {oldVd.getRootDirTableSector(), newVd.getRootDirTableSector()};
+    uint32_t sizes[2] = {oldVd.getRootDirTableSize(), newVd.getRootDirTableSize()};
+
+    compareDirectories(c, 0, sectors, sizes, "");
+}
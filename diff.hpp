@@ -0,0 +1,22 @@
+#pragma once
+
+#include "xdvdfs.hpp"
+#include <functional>
+#include <string>
+
+namespace diff
+{
+    enum Change {ADDED, REMOVED, MODIFIED};
+
+    typedef std::function<void (Change, const std::string&)> Reporter;
+
+    /**
+     * Which files of both images have their contents compared. By default,
+     * files with the same size and position are taken to be unchanged.
+    */
+    enum ContentMode {CONTENT_MOVED, CONTENT_ALL};
+
+    void compareImages (std::ifstream& oldFile, xdvdfs::VolumeDescriptor& oldVd,
+                        std::ifstream& newFile, xdvdfs::VolumeDescriptor& newVd,
+                        ContentMode mode, const Reporter& reporter);
+}
@@ -0,0 +1,329 @@
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+    struct Crc32Tables
+    {
+        uint32_t table[8][256];
+
+        Crc32Tables ()
+        {
+            for (uint32_t i=0; i<256; ++i)
+            {
+                uint32_t c = i;
+                for (int k=0; k<8; ++k)
+                    c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+                table[0][i] = c;
+            }
+
+            for (uint32_t i=0; i<256; ++i)
+            {
+                for (int t=1; t<8; ++t)
+                    table[t][i] = (table[t-1][i] >> 8) ^ table[0][table[t-1][i] & 0xFF];
+            }
+        }
+    };
+
+    const Crc32Tables crcTables;
+
+    inline uint32_t rotl (uint32_t x, int n)
+    {
+        return (x << n) | (x >> (32-n));
+    }
+
+    std::string toHex (const unsigned char* data, std::size_t length)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string result(length*2, '0');
+
+        for (std::size_t i=0; i<length; ++i)
+        {
+            result[2*i] = digits[data[i] >> 4];
+            result[2*i+1] = digits[data[i] & 0xF];
+        }
+
+        return result;
+    }
+}
+
+void hash::Crc32::update (const char* data, std::size_t length)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    const uint32_t (*t)[256] = crcTables.table;
+    uint32_t c = this->crc;
+
+    // slicing-by-8, the bytes are combined explicitly to stay endian-neutral
+    while (length >= 8)
+    {
+        uint32_t lo = c ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24));
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+          ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        length -= 8;
+    }
+
+    while (length-- > 0)
+        c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+
+    this->crc = c;
+}
+
+uint32_t hash::Crc32::value () const
+{
+    return this->crc ^ 0xFFFFFFFF;
+}
+
+std::string hash::Crc32::hexdigest () const
+{
+    return hexdigest(this->value());
+}
+
+std::string hash::Crc32::hexdigest (uint32_t value)
+{
+    char digest[9];
+    std::snprintf(digest, sizeof(digest), "%08x", value);
+    return digest;
+}
+
+namespace
+{
+    uint32_t gf2MatrixTimes (const uint32_t* mat, uint32_t vec)
+    {
+        uint32_t sum = 0;
+
+        for (; vec; vec >>= 1, ++mat)
+        {
+            if (vec & 1)
+                sum ^= *mat;
+        }
+
+        return sum;
+    }
+
+    void gf2MatrixSquare (uint32_t* square, const uint32_t* mat)
+    {
+        for (int n=0; n<32; ++n)
+            square[n] = gf2MatrixTimes(mat, mat[n]);
+    }
+}
+
+/**
+ * Returns the CRC of two concatenated blocks, given the CRC of both blocks
+ * and the length of the second one (the algorithm used by zlib's
+ * crc32_combine). This allows computing the CRC of parts independently.
+*/
+uint32_t hash::Crc32::combine (uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+    uint32_t even[32];  // even-power-of-two zeros operator
+    uint32_t odd[32];   // odd-power-of-two zeros operator
+
+    if (length2 == 0)
+        return crc1;
+
+    // operator for one zero bit
+    odd[0] = 0xEDB88320;
+    uint32_t row = 1;
+    for (int n=1; n<32; ++n)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2MatrixSquare(even, odd);     // two zero bits
+    gf2MatrixSquare(odd, even);     // four zero bits
+
+    // apply length2 zero bytes to crc1
+    do
+    {
+        gf2MatrixSquare(even, odd);
+        if (length2 & 1)
+            crc1 = gf2MatrixTimes(even, crc1);
+        length2 >>= 1;
+
+        if (length2 == 0)
+            break;
+
+        gf2MatrixSquare(odd, even);
+        if (length2 & 1)
+            crc1 = gf2MatrixTimes(odd, crc1);
+        length2 >>= 1;
+    } while (length2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+void hash::BlockHash::update (const char* data, std::size_t size)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    this->length += size;
+
+    if (this->buffered > 0)
+    {
+        std::size_t n = std::min(size, sizeof(this->buffer) - this->buffered);
+        std::memcpy(this->buffer + this->buffered, p, n);
+        this->buffered += n;
+        p += n;
+        size -= n;
+
+        if (this->buffered < sizeof(this->buffer))
+            return;
+
+        this->processBlock(this->buffer);
+        this->buffered = 0;
+    }
+
+    while (size >= 64)
+    {
+        this->processBlock(p);
+        p += 64;
+        size -= 64;
+    }
+
+    std::memcpy(this->buffer, p, size);
+    this->buffered = size;
+}
+
+void hash::BlockHash::pad (bool bigEndianLength)
+{
+    uint64_t bits = this->length * 8;
+
+    this->buffer[this->buffered++] = 0x80;
+    if (this->buffered > 56)
+    {
+        std::memset(this->buffer + this->buffered, 0, 64 - this->buffered);
+        this->processBlock(this->buffer);
+        this->buffered = 0;
+    }
+
+    std::memset(this->buffer + this->buffered, 0, 56 - this->buffered);
+    for (int i=0; i<8; ++i)
+        this->buffer[56+i] = static_cast<unsigned char>(bits >> (bigEndianLength ? 56-8*i : 8*i));
+
+    this->processBlock(this->buffer);
+    this->buffered = 0;
+}
+
+hash::Md5::Md5 ()
+{
+    this->state[0] = 0x67452301;
+    this->state[1] = 0xEFCDAB89;
+    this->state[2] = 0x98BADCFE;
+    this->state[3] = 0x10325476;
+}
+
+void hash::Md5::processBlock (const unsigned char* block)
+{
+    static const uint32_t K[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+    static const int S[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+    };
+
+    uint32_t m[16];
+    for (int i=0; i<16; ++i)
+        m[i] = block[4*i] | (block[4*i+1] << 8) | (block[4*i+2] << 16) | (static_cast<uint32_t>(block[4*i+3]) << 24);
+
+    uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+
+    for (int i=0; i<64; ++i)
+    {
+        uint32_t f;
+        int g;
+
+        if (i < 16)      { f = (b & c) | (~b & d); g = i; }
+        else if (i < 32) { f = (d & b) | (~d & c); g = (5*i + 1) % 16; }
+        else if (i < 48) { f = b ^ c ^ d;          g = (3*i + 5) % 16; }
+        else             { f = c ^ (b | ~d);       g = (7*i) % 16; }
+
+        uint32_t tmp = d;
+        d = c;
+        c = b;
+        b = b + rotl(a + f + K[i] + m[g], S[i]);
+        a = tmp;
+    }
+
+    this->state[0] += a;
+    this->state[1] += b;
+    this->state[2] += c;
+    this->state[3] += d;
+}
+
+std::string hash::Md5::hexdigest ()
+{
+    this->pad(false);
+
+    unsigned char digest[16];
+    for (int i=0; i<16; ++i)
+        digest[i] = static_cast<unsigned char>(this->state[i/4] >> (8*(i%4)));
+
+    return toHex(digest, sizeof(digest));
+}
+
+hash::Sha1::Sha1 ()
+{
+    this->state[0] = 0x67452301;
+    this->state[1] = 0xEFCDAB89;
+    this->state[2] = 0x98BADCFE;
+    this->state[3] = 0x10325476;
+    this->state[4] = 0xC3D2E1F0;
+}
+
+void hash::Sha1::processBlock (const unsigned char* block)
+{
+    uint32_t w[80];
+    for (int i=0; i<16; ++i)
+        w[i] = (static_cast<uint32_t>(block[4*i]) << 24) | (block[4*i+1] << 16) | (block[4*i+2] << 8) | block[4*i+3];
+    for (int i=16; i<80; ++i)
+        w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3], e = this->state[4];
+
+    for (int i=0; i<80; ++i)
+    {
+        uint32_t f, k;
+
+        if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+        else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+        else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+        else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+        uint32_t tmp = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = tmp;
+    }
+
+    this->state[0] += a;
+    this->state[1] += b;
+    this->state[2] += c;
+    this->state[3] += d;
+    this->state[4] += e;
+}
+
+std::string hash::Sha1::hexdigest ()
+{
+    this->pad(true);
+
+    unsigned char digest[20];
+    for (int i=0; i<20; ++i)
+        digest[i] = static_cast<unsigned char>(this->state[i/4] >> (24 - 8*(i%4)));
+
+    return toHex(digest, sizeof(digest));
+}
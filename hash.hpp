@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace hash
+{
+    /**
+     * CRC-32 as used by zlib and ZIP (reflected, polynomial 0xEDB88320),
+     * computed eight bytes at a time with the slicing-by-8 tables.
+    */
+    class Crc32
+    {
+        public:
+            Crc32 () : crc(0xFFFFFFFF) {}
+
+            void update (const char* data, std::size_t length);
+            uint32_t value () const;
+            std::string hexdigest () const;
+
+            static uint32_t combine (uint32_t crc1, uint32_t crc2, uint64_t length2);
+            static std::string hexdigest (uint32_t value);
+
+        private:
+            uint32_t crc;
+    };
+
+    /**
+     * Base class for the Merkle-Damgard hashes that work on 64 byte blocks.
+    */
+    class BlockHash
+    {
+        public:
+            BlockHash () : length(0), buffered(0) {}
+
+            void update (const char* data, std::size_t size);
+
+        protected:
+            virtual void processBlock (const unsigned char* block) = 0;
+            void pad (bool bigEndianLength);
+
+            uint64_t length;                ///< total number of bytes hashed
+            unsigned char buffer[64];       ///< incomplete block
+            std::size_t buffered;           ///< number of bytes in buffer
+    };
+
+    class Md5 : public BlockHash
+    {
+        public:
+            Md5 ();
+            std::string hexdigest ();
+
+        protected:
+            virtual void processBlock (const unsigned char* block);
+
+        private:
+            uint32_t state[4];
+    };
+
+    class Sha1 : public BlockHash
+    {
+        public:
+            Sha1 ();
+            std::string hexdigest ();
+
+        protected:
+            virtual void processBlock (const unsigned char* block);
+
+        private:
+            uint32_t state[5];
+    };
+
+    /**
+     * Computes CRC-32, MD5 and SHA-1 in a single pass over the data.
+    */
+    class FileHashes
+    {
+        public:
+            void update (const char* data, std::size_t length)
+            {
+                this->crc32.update(data, length);
+                this->md5.update(data, length);
+                this->sha1.update(data, length);
+            }
+
+            Crc32 crc32;
+            Md5 md5;
+            Sha1 sha1;
+    };
+}
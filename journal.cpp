@@ -0,0 +1,141 @@
+#include "journal.hpp"
+#include "xdvdfs.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+    #define fsync(a) _commit(a)
+    #define fileno(a) _fileno(a)
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+#endif
+
+namespace
+{
+    void syncFile (const std::string& filename)
+    {
+#if defined _WIN32
+        // committing a file requires write access on Windows
+        int fd = _open(filename.c_str(), _O_RDWR | _O_BINARY);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+#endif
+        if (fd < 0)
+            return;
+
+        fsync(fd);
+#if defined _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+}
+
+Journal::~Journal ()
+{
+    if (this->file)
+    {
+        this->checkpoint();
+        std::fclose(this->file);
+    }
+}
+
+/**
+ * Opens the journal. When resuming, the existing entries are loaded first and
+ * new entries get appended. A line without its terminating newline was cut off
+ * by the interruption and is ignored.
+*/
+void Journal::open (const std::string& filename, bool resume)
+{
+    bool truncated = false;
+
+    if (resume)
+    {
+        std::FILE* existing = std::fopen(filename.c_str(), "rb");
+        if (existing)
+        {
+            std::string line;
+            int c;
+
+            while ((c = std::fgetc(existing)) != EOF)
+            {
+                if (c != '\n')
+                {
+                    line += static_cast<char>(c);
+                    continue;
+                }
+
+                unsigned long long size;
+                int pathOffset = 0;
+                if (std::sscanf(line.c_str(), "%llu %n", &size, &pathOffset) == 1 && pathOffset > 0)
+                    this->completed[line.substr(pathOffset)] = size;
+
+                line.clear();
+            }
+
+            truncated = !line.empty();
+            std::fclose(existing);
+        }
+    }
+
+    this->file = std::fopen(filename.c_str(), resume ? "ab" : "wb");
+    if (!this->file)
+        throw new xdvdfs::Exception("Could not open journal file");
+
+    // terminate a cut off line, so it doesn't swallow the next entry
+    if (truncated)
+        std::fputc('\n', this->file);
+
+    this->lastCheckpoint = std::time(nullptr);
+}
+
+bool Journal::isComplete (const std::string& path, uint64_t size) const
+{
+    std::map<std::string, uint64_t>::const_iterator it = this->completed.find(path);
+    return it != this->completed.end() && it->second == size;
+}
+
+void Journal::record (const std::string& path, uint64_t size)
+{
+    Entry entry;
+    entry.path = path;
+    entry.line = std::to_string(size) + " " + path + "\n";
+
+    bool due;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending.push_back(entry);
+        due = this->pending.size() >= CHECKPOINT_ENTRIES || std::time(nullptr) - this->lastCheckpoint >= CHECKPOINT_SECONDS;
+    }
+
+    if (due)
+        this->checkpoint();
+}
+
+/**
+ * Flushes the files recorded since the last checkpoint to disk, then appends
+ * their entries to the journal and flushes it as well.
+*/
+void Journal::checkpoint ()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->lastCheckpoint = std::time(nullptr);
+
+    if (this->pending.empty())
+        return;
+
+    for (std::size_t i=0; i<this->pending.size(); ++i)
+        syncFile(this->pending[i].path);
+
+    for (std::size_t i=0; i<this->pending.size(); ++i)
+        std::fwrite(this->pending[i].line.data(), 1, this->pending[i].line.size(), this->file);
+    this->pending.clear();
+
+    std::fflush(this->file);
+    fsync(fileno(this->file));
+}
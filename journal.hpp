@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * This class records the files an extraction has completed, so an interrupted
+ * extraction can be resumed. Entries are collected in memory and only written
+ * at a checkpoint, after the files they refer to have been flushed to disk.
+ * Thus every entry in the journal refers to a file that is completely on
+ * disk. Recording entries is thread-safe.
+*/
+class Journal
+{
+    public:
+        Journal () : file(nullptr), lastCheckpoint(0) {}
+        ~Journal ();
+
+        void open (const std::string& filename, bool resume);
+        bool isOpen () const { return this->file != nullptr; }
+        bool isComplete (const std::string& path, uint64_t size) const;
+        void record (const std::string& path, uint64_t size);
+        void checkpoint ();
+
+        static const std::size_t CHECKPOINT_ENTRIES = 256;
+        static const std::time_t CHECKPOINT_SECONDS = 5;
+
+    private:
+        struct Entry
+        {
+            std::string path;
+            std::string line;
+        };
+
+        std::FILE* file;
+        std::map<std::string, uint64_t> completed;  ///< sizes of the files in the journal being resumed
+        std::vector<Entry> pending;                 ///< entries not yet written
+        std::time_t lastCheckpoint;
+        std::mutex mutex;           ///< guards pending and the journal file
+};
@@ -0,0 +1,332 @@
+#include "libxdvdfs.h"
+#include "xdvdfs.hpp"
+#include "pathindex.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+struct xdvdfs_image
+{
+    std::string filename;
+    std::ifstream file;
+    xdvdfs::PathIndex index;
+    bool indexed;
+    uint32_t rootSector;
+    uint32_t rootSize;
+    std::mutex mutex;
+};
+
+struct xdvdfs_dir
+{
+    xdvdfs_image* image;
+    std::vector<xdvdfs::DirectoryEntry> stack;      ///< entries whose right subtree hasn't been visited
+};
+
+namespace {
+    /**
+     * Runs a function and turns the exceptions thrown by the C++ classes into
+     * error codes. The stream has to be usable again after a failed read.
+    */
+    template<typename Function>
+    int guard (xdvdfs_image* image, Function function)
+    {
+        try {
+            return function();
+        } catch (xdvdfs::Exception* e) {
+            delete e;
+            image->file.clear();
+            return XDVDFS_ERROR_FORMAT;
+        } catch (std::bad_alloc&) {
+            image->file.clear();
+            return XDVDFS_ERROR_MEMORY;
+        } catch (std::exception&) {
+            image->file.clear();
+            return XDVDFS_ERROR_IO;
+        }
+    }
+
+    void toEntry (xdvdfs::DirectoryEntry& dirent, xdvdfs_entry* entry)
+    {
+        std::string name = dirent.getFilename();
+
+        entry->sector = dirent.getStartSector();
+        entry->size = static_cast<uint32_t>(dirent.getFileSize());
+        entry->attributes = dirent.getAttributes();
+        entry->name_length = static_cast<uint8_t>(name.size());
+        std::memcpy(entry->name, name.data(), name.size());
+        entry->name[name.size()] = '\0';
+    }
+
+    void pushLeft (xdvdfs_dir* dir, xdvdfs::DirectoryEntry dirent)
+    {
+        while (true)
+        {
+            dir->stack.push_back(dirent);
+            if (!dirent.hasLeftChild())
+                break;
+
+            dirent = dirent.getLeftChild(dir->image->file);
+        }
+    }
+}
+
+int xdvdfs_open (const char* filename, xdvdfs_image** image)
+{
+    if (!filename || !image)
+        return XDVDFS_ERROR_INVALID;
+
+    xdvdfs_image* result = new (std::nothrow) xdvdfs_image();
+    if (!result)
+        return XDVDFS_ERROR_MEMORY;
+
+    result->filename = filename;
+    result->indexed = false;
+    result->file.open(filename, std::ios::in | std::ios::binary);
+    if (!result->file.is_open())
+    {
+        delete result;
+        return XDVDFS_ERROR_IO;
+    }
+
+    result->file.exceptions(std::ios::failbit | std::ios::badbit | std::ios::eofbit);
+
+    int error = guard(result, [result] {
+        xdvdfs::VolumeDescriptor vd;
+        vd.readFromFile(result->file);
+        vd.validate();
+
+        result->rootSector = vd.getRootDirTableSector();
+        result->rootSize = vd.getRootDirTableSize();
+        return XDVDFS_OK;
+    });
+
+    if (error != XDVDFS_OK)
+    {
+        delete result;
+        return error;
+    }
+
+    *image = result;
+    return XDVDFS_OK;
+}
+
+void xdvdfs_close (xdvdfs_image* image)
+{
+    delete image;
+}
+
+int xdvdfs_opendir (xdvdfs_image* image, const xdvdfs_entry* directory, xdvdfs_dir** dir)
+{
+    if (!image || !dir)
+        return XDVDFS_ERROR_INVALID;
+
+    if (directory && !(directory->attributes & XDVDFS_ATTRIBUTE_DIRECTORY))
+        return XDVDFS_ERROR_INVALID;
+
+    xdvdfs_dir* result = new (std::nothrow) xdvdfs_dir();
+    if (!result)
+        return XDVDFS_ERROR_MEMORY;
+
+    result->image = image;
+
+    uint32_t sector = directory ? directory->sector : image->rootSector;
+    uint32_t size = directory ? directory->size : image->rootSize;
+
+    std::lock_guard<std::mutex> lock(image->mutex);
+
+    int error = guard(image, [result, sector, size] {
+        // empty directories don't have a directory table
+        if (size > 0)
+        {
+            xdvdfs::DirectoryEntry first;
+            first.readFromFile(result->image->file, sector);
+            pushLeft(result, first);
+        }
+
+        return XDVDFS_OK;
+    });
+
+    if (error != XDVDFS_OK)
+    {
+        delete result;
+        return error;
+    }
+
+    *dir = result;
+    return XDVDFS_OK;
+}
+
+int xdvdfs_readdir (xdvdfs_dir* dir, xdvdfs_entry* entry)
+{
+    if (!dir || !entry)
+        return XDVDFS_ERROR_INVALID;
+
+    if (dir->stack.empty())
+        return 0;
+
+    std::lock_guard<std::mutex> lock(dir->image->mutex);
+
+    return guard(dir->image, [dir, entry] {
+        xdvdfs::DirectoryEntry dirent = dir->stack.back();
+        dir->stack.pop_back();
+
+        if (dirent.hasRightChild())
+            pushLeft(dir, dirent.getRightChild(dir->image->file));
+
+        toEntry(dirent, entry);
+        return 1;
+    });
+}
+
+void xdvdfs_closedir (xdvdfs_dir* dir)
+{
+    delete dir;
+}
+
+int xdvdfs_lookup (xdvdfs_image* image, const char* path, xdvdfs_entry* entry)
+{
+    if (!image || !path || !entry)
+        return XDVDFS_ERROR_INVALID;
+
+    std::lock_guard<std::mutex> lock(image->mutex);
+
+    return guard(image, [image, path, entry] {
+        const xdvdfs::PathIndex::Entry* indexed = image->indexed ? image->index.find(path) : nullptr;
+        if (indexed)
+        {
+            std::string name = image->index.path(*indexed);
+            name = name.substr(name.find_last_of('/') + 1);
+
+            entry->sector = indexed->startSector;
+            entry->size = indexed->fileSize;
+            entry->attributes = indexed->attributes;
+            entry->name_length = static_cast<uint8_t>(name.size());
+            std::memcpy(entry->name, name.data(), name.size());
+            entry->name[name.size()] = '\0';
+            return XDVDFS_OK;
+        }
+
+        // everything but the root directory is in the index
+        if (image->indexed && std::strspn(path, "/") != std::strlen(path))
+            return XDVDFS_ERROR_NOT_FOUND;
+
+        uint32_t sector = image->rootSector;
+        uint32_t size = image->rootSize;
+        bool found = false;
+        xdvdfs::DirectoryEntry dirent;
+        const char* name = path;
+
+        while (*name)
+        {
+            const char* end = std::strchr(name, '/');
+            if (!end)
+                end = name + std::strlen(name);
+
+            // repeated, leading and trailing separators are ignored
+            if (end == name)
+            {
+                ++name;
+                continue;
+            }
+
+            if (found && !dirent.isDirectory())
+                return XDVDFS_ERROR_NOT_FOUND;
+
+            if (found)
+            {
+                sector = dirent.getStartSector();
+                size = static_cast<uint32_t>(dirent.getFileSize());
+            }
+
+            if (size == 0)
+                return XDVDFS_ERROR_NOT_FOUND;
+
+            xdvdfs::DirectoryEntry first;
+            first.readFromFile(image->file, sector);
+            if (!first.findEntry(image->file, std::string(name, end), dirent))
+                return XDVDFS_ERROR_NOT_FOUND;
+
+            found = true;
+            name = *end ? end + 1 : end;
+        }
+
+        if (found)
+        {
+            toEntry(dirent, entry);
+        }
+        else
+        {
+            std::memset(entry, 0, sizeof(*entry));
+            entry->sector = image->rootSector;
+            entry->size = image->rootSize;
+            entry->attributes = XDVDFS_ATTRIBUTE_DIRECTORY;
+        }
+
+        return XDVDFS_OK;
+    });
+}
+
+int xdvdfs_use_index (xdvdfs_image* image, unsigned int threads)
+{
+    if (!image)
+        return XDVDFS_ERROR_INVALID;
+
+    std::lock_guard<std::mutex> lock(image->mutex);
+
+    return guard(image, [image, threads] {
+        image->index.loadOrBuild(image->filename, threads);
+        image->indexed = true;
+        return XDVDFS_OK;
+    });
+}
+
+int64_t xdvdfs_read (xdvdfs_image* image, const xdvdfs_entry* entry, uint64_t offset, void* buffer, size_t size)
+{
+    if (!image || !entry || (!buffer && size > 0))
+        return XDVDFS_ERROR_INVALID;
+
+    if (entry->attributes & XDVDFS_ATTRIBUTE_DIRECTORY)
+        return XDVDFS_ERROR_INVALID;
+
+    if (offset >= entry->size)
+        return 0;
+
+    uint64_t length = entry->size - offset;
+    if (length > size)
+        length = size;
+
+    std::lock_guard<std::mutex> lock(image->mutex);
+
+    int error = guard(image, [image, entry, offset, buffer, length] {
+        image->file.seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * entry->sector + offset, std::ios::beg);
+        image->file.read(static_cast<char*>(buffer), length);
+        return XDVDFS_OK;
+    });
+
+    return error != XDVDFS_OK ? error : static_cast<int64_t>(length);
+}
+
+const char* xdvdfs_strerror (int error)
+{
+    switch (error)
+    {
+        case XDVDFS_OK:
+            return "Success";
+        case XDVDFS_ERROR_IO:
+            return "Reading the image failed";
+        case XDVDFS_ERROR_FORMAT:
+            return "Invalid image";
+        case XDVDFS_ERROR_NOT_FOUND:
+            return "No such file or directory";
+        case XDVDFS_ERROR_INVALID:
+            return "Invalid argument";
+        case XDVDFS_ERROR_MEMORY:
+            return "Out of memory";
+        default:
+            return "Unknown error";
+    }
+}
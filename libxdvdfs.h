@@ -0,0 +1,78 @@
+/*
+ * C interface to libxdvdfs, for reading XDVDFS images without going through
+ * the xbiso executable. All buffers are provided by the caller; the library
+ * only allocates the image and directory handles.
+ *
+ * Functions return XDVDFS_OK (or a count) on success and one of the negative
+ * XDVDFS_ERROR_* codes on failure. An image may be used from several threads,
+ * calls on the same image are serialized.
+ */
+#ifndef LIBXDVDFS_H
+#define LIBXDVDFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XDVDFS_API_VERSION 1
+
+#define XDVDFS_OK               0
+#define XDVDFS_ERROR_IO        -1   /* reading the image failed */
+#define XDVDFS_ERROR_FORMAT    -2   /* the image or one of its tables is invalid */
+#define XDVDFS_ERROR_NOT_FOUND -3   /* no entry with the given path */
+#define XDVDFS_ERROR_INVALID   -4   /* invalid argument, e.g. reading a directory */
+#define XDVDFS_ERROR_MEMORY    -5
+
+#define XDVDFS_ATTRIBUTE_READONLY  0x01
+#define XDVDFS_ATTRIBUTE_HIDDEN    0x02
+#define XDVDFS_ATTRIBUTE_SYSTEM    0x04
+#define XDVDFS_ATTRIBUTE_DIRECTORY 0x10
+#define XDVDFS_ATTRIBUTE_ARCHIVE   0x20
+#define XDVDFS_ATTRIBUTE_NORMAL    0x80
+
+#define XDVDFS_NAME_MAX 255
+
+typedef struct xdvdfs_image xdvdfs_image;
+typedef struct xdvdfs_dir xdvdfs_dir;
+
+typedef struct xdvdfs_entry
+{
+    uint32_t sector;                    /* first sector of the data or directory table */
+    uint32_t size;                      /* size in bytes, 0 for empty directories */
+    uint8_t attributes;                 /* XDVDFS_ATTRIBUTE_* flags */
+    uint8_t name_length;
+    char name[XDVDFS_NAME_MAX + 1];     /* null-terminated, empty for the root directory */
+} xdvdfs_entry;
+
+int xdvdfs_open (const char* filename, xdvdfs_image** image);
+void xdvdfs_close (xdvdfs_image* image);
+
+/* Iterates a directory in the order of its table, which is sorted by name.
+   Passing NULL as the directory opens the root directory. xdvdfs_readdir
+   returns 1 for every entry and 0 at the end. */
+int xdvdfs_opendir (xdvdfs_image* image, const xdvdfs_entry* directory, xdvdfs_dir** dir);
+int xdvdfs_readdir (xdvdfs_dir* dir, xdvdfs_entry* entry);
+void xdvdfs_closedir (xdvdfs_dir* dir);
+
+/* Looks up an entry by its path, using '/' as separator. Names are compared
+   case-insensitively, like the Xbox does. */
+int xdvdfs_lookup (xdvdfs_image* image, const char* path, xdvdfs_entry* entry);
+
+/* Makes lookups use a hash index of all paths, loaded from the sidecar file
+   next to the image or built with up to threads threads and stored there. */
+int xdvdfs_use_index (xdvdfs_image* image, unsigned int threads);
+
+/* Reads up to size bytes of a file starting at offset. Returns the number of
+   bytes read, which is only less than size at the end of the file. */
+int64_t xdvdfs_read (xdvdfs_image* image, const xdvdfs_entry* entry, uint64_t offset, void* buffer, size_t size);
+
+const char* xdvdfs_strerror (int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+#include "logger.hpp"
+
+#include <chrono>
+
+const unsigned int Logger::FLUSH_MILLISECONDS;
+
+void Logger::start (std::FILE* output)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->output = output;
+    this->running = true;
+    this->stopping = false;
+    this->thread = std::thread(&Logger::run, this);
+}
+
+/**
+ * Writes all queued messages and stops the writer.
+*/
+void Logger::stop ()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->running)
+            return;
+
+        this->stopping = true;
+    }
+
+    this->wakeup.notify_all();
+    this->thread.join();
+    this->running = false;
+}
+
+void Logger::write (Logger::Level level, const std::string& message)
+{
+    if (!this->isEnabled(level))
+        return;
+
+    Message m;
+    m.level = level;
+    m.text = message;
+    m.text += '\n';
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (!this->running)
+    {
+        std::vector<Message> messages(1, m);
+        this->print(messages, this->statusLine, false);
+        return;
+    }
+
+    bool wasEmpty = this->queue.empty();
+    this->queue.push_back(m);
+    lock.unlock();
+
+    if (wasEmpty)
+        this->wakeup.notify_one();
+}
+
+/**
+ * Replaces the status line. A final status is printed once more and then
+ * left on screen.
+*/
+void Logger::status (const std::string& line, bool final)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->statusLine = line;
+    this->statusFinal = this->statusFinal || final;
+
+    if (!this->running)
+    {
+        this->print(std::vector<Message>(), this->statusLine, this->statusFinal);
+        this->statusLine.clear();
+        this->statusFinal = false;
+        return;
+    }
+
+    this->statusChanged = true;
+    lock.unlock();
+
+    this->wakeup.notify_one();
+}
+
+void Logger::run ()
+{
+    std::vector<Message> batch;
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true)
+    {
+        this->wakeup.wait(lock, [this] { return !this->queue.empty() || this->statusChanged || this->stopping; });
+
+        if (this->queue.empty() && !this->statusChanged)
+            break;
+
+        batch.swap(this->queue);
+        std::string status = this->statusLine;
+        bool final = this->statusFinal;
+        this->statusChanged = false;
+
+        if (final)
+        {
+            this->statusLine.clear();
+            this->statusFinal = false;
+        }
+
+        lock.unlock();
+
+        this->print(batch, status, final);
+        batch.clear();
+
+        lock.lock();
+
+        // give the workers time to queue more messages for the next batch
+        this->wakeup.wait_for(lock, std::chrono::milliseconds(FLUSH_MILLISECONDS), [this] { return this->stopping; });
+    }
+}
+
+void Logger::print (const std::vector<Logger::Message>& messages, const std::string& status, bool final)
+{
+    if (this->statusShown && !messages.empty())
+    {
+        std::fputs("\r\033[K", stderr);
+        std::fflush(stderr);
+    }
+
+    std::FILE* current = nullptr;
+
+    for (std::size_t i=0; i<messages.size(); ++i)
+    {
+        std::FILE* stream = messages[i].level == LEVEL_ERROR ? stderr : this->output;
+
+        // both streams usually end up on the same terminal, where the lines have to stay in order
+        if (current && current != stream)
+            std::fflush(current);
+
+        std::fwrite(messages[i].text.data(), 1, messages[i].text.size(), stream);
+        current = stream;
+    }
+
+    if (current)
+        std::fflush(current);
+
+    if (!status.empty())
+    {
+        std::fprintf(stderr, "\r%s\033[K%s", status.c_str(), final ? "\n" : "");
+        std::fflush(stderr);
+    }
+
+    this->statusShown = !status.empty() && !final;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * This class collects log messages from all threads and writes them from a
+ * background thread in batches, so printing a line per file doesn't cost
+ * the extraction a flush and a write call each. Errors go to stderr, all
+ * other messages to the output stream. Until the writer is started, or
+ * after it's stopped, messages are written immediately.
+ *
+ * A status line, like the progress of an extraction, is kept at the bottom
+ * of stderr: it's cleared before messages are written and drawn again
+ * afterwards, so they never overwrite each other.
+*/
+class Logger
+{
+    public:
+        enum Level {LEVEL_ERROR, LEVEL_INFO, LEVEL_VERBOSE};
+
+        Logger () : level(LEVEL_INFO), output(stdout), statusChanged(false), statusFinal(false), statusShown(false), running(false), stopping(false) {}
+        ~Logger () { this->stop(); }
+
+        void setLevel (Level level) { this->level = level; }
+        bool isEnabled (Level level) const { return level <= this->level; }
+
+        void start (std::FILE* output);
+        void stop ();
+        void write (Level level, const std::string& message);
+        void status (const std::string& line, bool final);
+
+        static const unsigned int FLUSH_MILLISECONDS = 100;
+
+    private:
+        struct Message
+        {
+            Level level;
+            std::string text;
+        };
+
+        void run ();
+        void print (const std::vector<Message>& messages, const std::string& status, bool final);
+
+        Level level;
+        std::FILE* output;
+        std::vector<Message> queue;
+        std::string statusLine;
+        bool statusChanged;
+        bool statusFinal;           ///< the status line stays on screen and the next one starts below it
+        bool statusShown;           ///< only touched while printing
+        bool running;
+        bool stopping;
+        std::thread thread;
+        std::mutex mutex;           ///< guards the queue, the status line and the state of the writer
+        std::condition_variable wakeup;
+};
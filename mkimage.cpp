@@ -0,0 +1,555 @@
+/*
+ * xbiso-mkimage - generator for synthetic XDVDFS images
+ * Copyright (C) 2015 Stefan Schmidt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*/
+
+#include "xdvdfs.hpp"
+#include "optionparser.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#endif
+
+struct Arg: public option::Arg {
+    static option::ArgStatus Numeric (const option::Option& option, bool msg) {
+        char* end = nullptr;
+        if (option.arg && (std::strtoull(option.arg, &end, 10), end != option.arg) && *end == '\0')
+            return option::ARG_OK;
+
+        if (msg)
+            std::cerr << "Option '" << option.name << "' requires a numeric argument" << std::endl;
+
+        return option::ARG_ILLEGAL;
+    }
+
+    static option::ArgStatus NonEmpty (const option::Option& option, bool msg) {
+        if (option.arg)
+            return option::ARG_OK;
+
+        if (msg)
+            std::cerr << "Option '" << option.name << "' requires an argument" << std::endl;
+
+        return option::ARG_ILLEGAL;
+    }
+};
+
+/**
+ * The creation time written into every image, in seconds since 1970.
+*/
+const uint64_t IMAGE_TIME = 1005782400;     // 2001-11-15
+
+enum optionIndex {UNKNOWN, HELP, FILES, MINSIZE, MAXSIZE, DISTRIBUTION, DEPTH, FANOUT, HUGEDIR, DEGENERATE, FRAGMENTED, CONTENT, SEED};
+const option::Descriptor usage[] = {
+    {UNKNOWN, 0, "", "", option::Arg::None, ""},
+    {HELP, 0, "h", "help", option::Arg::None, ""},
+    {FILES, 0, "n", "files", Arg::Numeric, ""},
+    {MINSIZE, 0, "", "min-size", Arg::Numeric, ""},
+    {MAXSIZE, 0, "", "max-size", Arg::Numeric, ""},
+    {DISTRIBUTION, 0, "", "distribution", Arg::NonEmpty, ""},
+    {DEPTH, 0, "", "depth", Arg::Numeric, ""},
+    {FANOUT, 0, "", "fanout", Arg::Numeric, ""},
+    {HUGEDIR, 0, "", "huge-dir", Arg::Numeric, ""},
+    {DEGENERATE, 0, "", "degenerate", option::Arg::None, ""},
+    {FRAGMENTED, 0, "", "fragmented", option::Arg::None, ""},
+    {CONTENT, 0, "", "content", Arg::NonEmpty, ""},
+    {SEED, 0, "", "seed", Arg::Numeric, ""},
+    {0,0,0,0,0,0}
+};
+
+void printUsage ()
+{
+    std::cout << "Usage: xbiso-mkimage [options] output\n"
+              << "Writes a synthetic XDVDFS image to output, or to stdout if output is '-'.\n"
+              << "Options:\n"
+              << "  -n,--files <n>         Number of files (default: 1000)\n"
+              << "  --min-size <bytes>     Minimum file size (default: 0)\n"
+              << "  --max-size <bytes>     Maximum file size (default: 65536)\n"
+              << "  --distribution <dist>  File size distribution: uniform, exponential\n"
+              << "                         or fixed (always max-size) (default: uniform)\n"
+              << "  --depth <n>            Depth of the directory tree (default: 2)\n"
+              << "  --fanout <n>           Subdirectories per directory (default: 4)\n"
+              << "  --huge-dir <n>         Add a directory containing <n> more files\n"
+              << "  --degenerate           Store directory tables as unbalanced trees\n"
+              << "  --fragmented           Scatter file data across the image with gaps\n"
+              << "  --content <type>       File contents: random, zero or pattern\n"
+              << "                         (default: random)\n"
+              << "  --seed <n>             Seed for the random generator (default: 1)\n"
+              << std::endl;
+}
+
+struct File
+{
+    std::string name;
+    uint32_t size;
+    uint32_t sector;
+};
+
+struct Directory
+{
+    std::string name;
+    std::vector<std::unique_ptr<Directory> > subdirs;
+    std::vector<File> files;
+
+    std::vector<char> table;    ///< the encoded directory table
+    uint32_t sector;
+};
+
+/**
+ * An entry of a directory table before it is encoded.
+*/
+struct TableEntry
+{
+    std::string name;
+    uint32_t sector;
+    uint32_t size;
+    uint8_t attributes;
+    std::size_t offset;
+    int left;
+    int right;
+};
+
+static int buildBalanced (std::vector<TableEntry>& entries, int lo, int hi, std::vector<int>& order)
+{
+    if (lo > hi)
+        return -1;
+
+    int mid = (lo + hi) / 2;
+    order.push_back(mid);
+    entries[mid].left = buildBalanced(entries, lo, mid-1, order);
+    entries[mid].right = buildBalanced(entries, mid+1, hi, order);
+    return mid;
+}
+
+static void putLe (char* p, uint64_t value, int bytes)
+{
+    for (int i=0; i<bytes; ++i)
+        p[i] = static_cast<char>(value >> (8*i));
+}
+
+/**
+ * Encodes a directory table. Entries are sorted the way xdvdfs compares names
+ * and stored as a binary search tree in pre-order, each aligned to 4 bytes
+ * and never crossing a sector boundary. Unused space is filled with 0xFF.
+ * A degenerate tree only uses right children.
+*/
+static void encodeTable (Directory& dir, bool degenerate)
+{
+    std::vector<TableEntry> entries;
+
+    for (std::size_t i=0; i<dir.subdirs.size(); ++i)
+    {
+        TableEntry e = {dir.subdirs[i]->name, dir.subdirs[i]->sector, static_cast<uint32_t>(dir.subdirs[i]->table.size()),
+                        xdvdfs::DirectoryEntry::FILE_DIRECTORY, 0, -1, -1};
+        entries.push_back(e);
+    }
+
+    for (std::size_t i=0; i<dir.files.size(); ++i)
+    {
+        TableEntry e = {dir.files[i].name, dir.files[i].sector, dir.files[i].size,
+                        xdvdfs::DirectoryEntry::FILE_ARCHIVE, 0, -1, -1};
+        entries.push_back(e);
+    }
+
+    dir.table.clear();
+    if (entries.empty())
+        return;
+
+    std::sort(entries.begin(), entries.end(), [] (const TableEntry& a, const TableEntry& b) {
+        return xdvdfs::compareFilenames(a.name, b.name) < 0;
+    });
+
+    std::vector<int> order;
+    if (degenerate)
+    {
+        for (std::size_t i=0; i<entries.size(); ++i)
+        {
+            order.push_back(i);
+            entries[i].right = (i+1 < entries.size()) ? static_cast<int>(i+1) : -1;
+        }
+    }
+    else
+    {
+        buildBalanced(entries, 0, entries.size()-1, order);
+    }
+
+    std::size_t offset = 0;
+    for (std::size_t i=0; i<order.size(); ++i)
+    {
+        TableEntry& e = entries[order[i]];
+        std::size_t length = (14 + e.name.size() + 3) & ~static_cast<std::size_t>(3);
+
+        if (offset / xdvdfs::SECTOR_SIZE != (offset + length - 1) / xdvdfs::SECTOR_SIZE)
+            offset = (offset / xdvdfs::SECTOR_SIZE + 1) * xdvdfs::SECTOR_SIZE;
+
+        e.offset = offset;
+        offset += length;
+    }
+
+    if (offset > 0xFFFF * 4)
+        throw new xdvdfs::Exception("Directory table too large, use fewer files per directory");
+
+    std::size_t size = (offset + xdvdfs::SECTOR_SIZE - 1) / xdvdfs::SECTOR_SIZE * xdvdfs::SECTOR_SIZE;
+    dir.table.assign(size, static_cast<char>(0xFF));
+
+    for (std::size_t i=0; i<entries.size(); ++i)
+    {
+        TableEntry& e = entries[i];
+        char* p = &dir.table[e.offset];
+
+        putLe(p, e.left >= 0 ? entries[e.left].offset / 4 : 0, 2);
+        putLe(p+2, e.right >= 0 ? entries[e.right].offset / 4 : 0, 2);
+        putLe(p+4, e.sector, 4);
+        putLe(p+8, e.size, 4);
+        p[12] = static_cast<char>(e.attributes);
+        p[13] = static_cast<char>(e.name.size());
+        std::memcpy(p+14, e.name.data(), e.name.size());
+    }
+}
+
+/**
+ * A contiguous part of the image. Parts are written in the order of their
+ * sectors, everything in between is zero.
+*/
+struct Region
+{
+    uint32_t sector;
+    const std::vector<char>* table;     ///< directory table, or null for file data
+    uint32_t size;
+    uint64_t seed;
+};
+
+class Generator
+{
+    public:
+        Generator (std::FILE* out, const std::string& content) : out(out), content(content), position(0), buffer(1024*1024) {}
+
+        void writeZeros (uint64_t bytes)
+        {
+            std::memset(this->buffer.data(), 0, std::min<uint64_t>(bytes, this->buffer.size()));
+            while (bytes > 0)
+            {
+                std::size_t n = std::min<uint64_t>(bytes, this->buffer.size());
+                this->write(this->buffer.data(), n);
+                bytes -= n;
+            }
+        }
+
+        void writeFile (uint32_t size, uint64_t seed)
+        {
+            uint64_t state = seed | 1;
+            uint64_t done = 0;
+
+            while (done < size)
+            {
+                std::size_t n = std::min<uint64_t>(size - done, this->buffer.size());
+
+                if (this->content == "zero")
+                {
+                    std::memset(this->buffer.data(), 0, n);
+                }
+                else if (this->content == "pattern")
+                {
+                    for (std::size_t i=0; i<n; ++i)
+                        this->buffer[i] = static_cast<char>((done + i) * 31 + seed);
+                }
+                else
+                {
+                    // xorshift64 is fast enough to generate gigabytes per second
+                    for (std::size_t i=0; i<n; i+=8)
+                    {
+                        state ^= state << 13;
+                        state ^= state >> 7;
+                        state ^= state << 17;
+                        std::memcpy(&this->buffer[i], &state, std::min<std::size_t>(8, n-i));
+                    }
+                }
+
+                this->write(this->buffer.data(), n);
+                done += n;
+            }
+        }
+
+        void write (const char* data, std::size_t length)
+        {
+            if (std::fwrite(data, 1, length, this->out) != length)
+                throw new xdvdfs::Exception("Writing the image failed");
+            this->position += length;
+        }
+
+        void padToSector ()
+        {
+            this->writeZeros((xdvdfs::SECTOR_SIZE - this->position % xdvdfs::SECTOR_SIZE) % xdvdfs::SECTOR_SIZE);
+        }
+
+        uint64_t getPosition () const { return this->position; }
+
+    private:
+        std::FILE* out;
+        std::string content;
+        uint64_t position;
+        std::vector<char> buffer;
+};
+
+static uint64_t optionValue (option::Option& opt, uint64_t defaultValue)
+{
+    return opt ? std::strtoull(opt.arg, nullptr, 10) : defaultValue;
+}
+
+static void collectDirectories (Directory* dir, std::vector<Directory*>& dirs)
+{
+    dirs.push_back(dir);
+    for (std::size_t i=0; i<dir->subdirs.size(); ++i)
+        collectDirectories(dir->subdirs[i].get(), dirs);
+}
+
+static void addSubdirectories (Directory* dir, uint64_t depth, uint64_t fanout)
+{
+    if (depth == 0)
+        return;
+
+    for (uint64_t i=0; i<fanout; ++i)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "dir%03llu", static_cast<unsigned long long>(i));
+
+        std::unique_ptr<Directory> sub(new Directory());
+        sub->name = name;
+        addSubdirectories(sub.get(), depth-1, fanout);
+        dir->subdirs.push_back(std::move(sub));
+    }
+}
+
+static uint32_t sectorsFor (uint64_t bytes)
+{
+    return (bytes + xdvdfs::SECTOR_SIZE - 1) / xdvdfs::SECTOR_SIZE;
+}
+
+int main (int argc, char* argv[])
+{
+    argc -= (argc>0); argv += (argc>0);
+
+    option::Stats stats(usage, argc, argv);
+    std::vector<option::Option> options(stats.options_max);
+    std::vector<option::Option> buffer(stats.buffer_max);
+    option::Parser parse(usage, argc, argv, &options[0], &buffer[0]);
+
+    if (parse.error())
+        return 1;
+
+    if (options[HELP] || parse.nonOptionsCount() != 1) {
+        printUsage();
+        return options[HELP] ? 0 : 1;
+    }
+
+    uint64_t fileCount = optionValue(options[FILES], 1000);
+    uint64_t minSize = optionValue(options[MINSIZE], 0);
+    uint64_t maxSize = std::max(minSize, optionValue(options[MAXSIZE], 65536));
+    uint64_t depth = optionValue(options[DEPTH], 2);
+    uint64_t fanout = optionValue(options[FANOUT], 4);
+    uint64_t hugeDir = optionValue(options[HUGEDIR], 0);
+    std::string distribution = options[DISTRIBUTION] ? options[DISTRIBUTION].arg : "uniform";
+    std::string content = options[CONTENT] ? options[CONTENT].arg : "random";
+    bool degenerate = options[DEGENERATE];
+    bool fragmented = options[FRAGMENTED];
+
+    if (maxSize > 0xFFFFFFFFULL) {
+        std::cerr << "ERROR: Files can't be larger than 4 GiB" << std::endl;
+        return 1;
+    }
+
+    if (distribution != "uniform" && distribution != "exponential" && distribution != "fixed") {
+        std::cerr << "ERROR: Unknown distribution '" << distribution << "'" << std::endl;
+        return 1;
+    }
+
+    if (content != "random" && content != "zero" && content != "pattern") {
+        std::cerr << "ERROR: Unknown content type '" << content << "'" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 random(optionValue(options[SEED], 1));
+
+    // build the tree and spread the files evenly over its directories
+    Directory root;
+    addSubdirectories(&root, depth, fanout);
+
+    std::vector<Directory*> dirs;
+    collectDirectories(&root, dirs);
+
+    std::uniform_int_distribution<uint64_t> uniform(minSize, maxSize);
+    std::exponential_distribution<double> exponential(1.0 / std::max<double>(1.0, (minSize + maxSize) / 2.0));
+
+    for (uint64_t i=0; i<fileCount + hugeDir; ++i)
+    {
+        Directory* dir;
+        if (i < fileCount)
+        {
+            dir = dirs[i % dirs.size()];
+        }
+        else
+        {
+            if (i == fileCount)
+            {
+                std::unique_ptr<Directory> huge(new Directory());
+                huge->name = "huge";
+                root.subdirs.push_back(std::move(huge));
+            }
+            dir = root.subdirs.back().get();
+        }
+
+        uint64_t size;
+        if (distribution == "fixed")
+            size = maxSize;
+        else if (distribution == "exponential")
+            size = std::min<uint64_t>(maxSize, minSize + static_cast<uint64_t>(exponential(random)));
+        else
+            size = uniform(random);
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "file%07llu.dat", static_cast<unsigned long long>(i));
+
+        File file = {name, static_cast<uint32_t>(size), 0};
+        dir->files.push_back(file);
+    }
+
+    dirs.clear();
+    collectDirectories(&root, dirs);
+
+    try
+    {
+        // the table sizes don't depend on the sectors, so they can be laid out first
+        for (std::size_t i=0; i<dirs.size(); ++i)
+            encodeTable(*dirs[i], degenerate);
+
+        uint32_t sector = xdvdfs::VOLUME_DESCRIPTOR_SECTOR + 1;
+        std::vector<Region> regions;
+
+        for (std::size_t i=0; i<dirs.size(); ++i)
+        {
+            dirs[i]->sector = dirs[i]->table.empty() ? 0 : sector;
+            sector += sectorsFor(dirs[i]->table.size());
+        }
+
+        std::vector<File*> files;
+        for (std::size_t i=0; i<dirs.size(); ++i)
+        {
+            for (std::size_t j=0; j<dirs[i]->files.size(); ++j)
+                files.push_back(&dirs[i]->files[j]);
+        }
+
+        if (fragmented)
+            std::shuffle(files.begin(), files.end(), random);
+
+        std::uniform_int_distribution<uint32_t> gap(0, 16);
+        for (std::size_t i=0; i<files.size(); ++i)
+        {
+            if (fragmented)
+                sector += gap(random);
+
+            files[i]->sector = files[i]->size == 0 ? 0 : sector;
+            sector += sectorsFor(files[i]->size);
+
+            if (files[i]->size > 0)
+            {
+                Region r = {files[i]->sector, nullptr, files[i]->size, random()};
+                regions.push_back(r);
+            }
+        }
+
+        // now that all sectors are known, encode the tables with them
+        for (std::size_t i=dirs.size(); i-- > 0;)
+        {
+            encodeTable(*dirs[i], degenerate);
+            if (!dirs[i]->table.empty())
+            {
+                Region r = {dirs[i]->sector, &dirs[i]->table, static_cast<uint32_t>(dirs[i]->table.size()), 0};
+                regions.push_back(r);
+            }
+        }
+
+        std::sort(regions.begin(), regions.end(), [] (const Region& a, const Region& b) { return a.sector < b.sector; });
+
+        std::string filename = parse.nonOption(0);
+        std::FILE* out;
+        if (filename == "-")
+        {
+#if defined _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            out = stdout;
+        }
+        else
+        {
+            out = std::fopen(filename.c_str(), "wb");
+        }
+
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not open file '" << filename << "'" << std::endl;
+            return 1;
+        }
+
+        Generator generator(out, content);
+        generator.writeZeros(static_cast<uint64_t>(xdvdfs::VOLUME_DESCRIPTOR_SECTOR) * xdvdfs::SECTOR_SIZE);
+
+        // volume descriptor, the creation time is a FILETIME; it's fixed, so the same seed always gives the same image
+        std::vector<char> vd(xdvdfs::SECTOR_SIZE, 0);
+        uint64_t filetime = (IMAGE_TIME + 11644473600ULL) * 10000000ULL;
+        std::memcpy(&vd[0], xdvdfs::MAGIC_NUMBER, 0x14);
+        putLe(&vd[0x14], root.sector, 4);
+        putLe(&vd[0x18], root.table.size(), 4);
+        putLe(&vd[0x1C], filetime, 8);
+        std::memcpy(&vd[0x7EC], xdvdfs::MAGIC_NUMBER, 0x14);
+        generator.write(vd.data(), vd.size());
+
+        for (std::size_t i=0; i<regions.size(); ++i)
+        {
+            generator.writeZeros(static_cast<uint64_t>(regions[i].sector) * xdvdfs::SECTOR_SIZE - generator.getPosition());
+
+            if (regions[i].table)
+                generator.write(regions[i].table->data(), regions[i].table->size());
+            else
+                generator.writeFile(regions[i].size, regions[i].seed);
+
+            generator.padToSector();
+        }
+
+        if (out != stdout)
+            std::fclose(out);
+        else
+            std::fflush(out);
+
+        std::cerr << dirs.size() << " directories, " << files.size() << " files, "
+                  << generator.getPosition() << " bytes" << std::endl;
+    }
+    catch (xdvdfs::Exception* e)
+    {
+        std::cerr << "ERROR: " << e->what() << std::endl;
+        delete e;
+        return 1;
+    }
+
+    return 0;
+}
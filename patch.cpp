@@ -0,0 +1,594 @@
+#include "patch.hpp"
+#include "xdvdfs.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#if defined _WIN32
+    #include <process.h>
+    #include <stdlib.h>
+    #define NOMINMAX
+    #include <windows.h>
+    #define getpid _getpid
+#else
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/*
+ * A patch rebuilds the new image from start to end out of three kinds of
+ * operations: copying a range of the old image, writing zeros and writing
+ * data stored in the patch. All numbers are little-endian.
+ *
+ *   header:    "XBPATCH1", old image size (8), new image size (8), CRC-32 of the new image (4)
+ *   operation: type (1), length (8), followed by
+ *              COPY: offset in the old image (8)
+ *              DATA: length bytes of data
+ *              ZERO: nothing
+ *   end:       type END (1)
+ */
+
+namespace {
+    const char PATCH_MAGIC[8] = {'X', 'B', 'P', 'A', 'T', 'C', 'H', '1'};
+
+    enum Operation {OP_END = 0, OP_COPY = 1, OP_DATA = 2, OP_ZERO = 3};
+
+    const std::size_t BLOCK_SIZE = 1024;                    ///< granularity of the rolling hash matching
+    const std::size_t CHUNK_SIZE = 64 * 1024;               ///< buffer size for streaming
+    const std::size_t MAX_PENDING_DATA = 1024 * 1024;       ///< literal data buffered before it's written
+    const uint64_t MAX_MATCHED_FILE = 64 * 1024 * 1024;     ///< larger files are only compared block by block
+
+    struct Extent
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    void put (std::FILE* file, uint64_t value, int bytes)
+    {
+        char buffer[8];
+        for (int i=0; i<bytes; ++i)
+            buffer[i] = static_cast<char>(value >> (i*8));
+
+        if (std::fwrite(buffer, 1, bytes, file) != static_cast<std::size_t>(bytes))
+            throw new xdvdfs::Exception("Writing the patch failed");
+    }
+
+    uint64_t get (std::FILE* file, int bytes)
+    {
+        unsigned char buffer[8];
+        if (std::fread(buffer, 1, bytes, file) != static_cast<std::size_t>(bytes))
+            throw new xdvdfs::Exception("Patch is truncated");
+
+        uint64_t value = 0;
+        for (int i=0; i<bytes; ++i)
+            value |= static_cast<uint64_t>(buffer[i]) << (i*8);
+        return value;
+    }
+
+    bool isZero (const char* data, std::size_t length)
+    {
+        for (std::size_t i=0; i<length; ++i)
+        {
+            if (data[i] != 0)
+                return false;
+        }
+        return true;
+    }
+
+    void readAt (std::ifstream& file, uint64_t offset, char* data, std::size_t length)
+    {
+        file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        file.read(data, length);
+    }
+
+    uint64_t remaining (uint64_t size, uint64_t offset)
+    {
+        return offset < size ? size - offset : 0;
+    }
+
+    /**
+     * Returns whether two paths refer to the same file, so writing one would
+     * destroy the other.
+    */
+    bool isSameFile (const std::string& a, const std::string& b)
+    {
+#if defined _WIN32
+        char pathA[_MAX_PATH], pathB[_MAX_PATH];
+        return _fullpath(pathA, a.c_str(), _MAX_PATH) && _fullpath(pathB, b.c_str(), _MAX_PATH) && _stricmp(pathA, pathB) == 0;
+#else
+        struct stat stA, stB;
+        return stat(a.c_str(), &stA) == 0 && stat(b.c_str(), &stB) == 0 && stA.st_dev == stB.st_dev && stA.st_ino == stB.st_ino;
+#endif
+    }
+
+    /**
+     * Moves a completely written temporary file over the target, which may
+     * exist already.
+    */
+    bool replaceFile (const std::string& temporary, const std::string& target)
+    {
+#if defined _WIN32
+        return MoveFileExA(temporary.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(temporary.c_str(), target.c_str()) == 0;
+#endif
+    }
+
+    uint64_t fileSize (std::ifstream& file)
+    {
+        file.seekg(0, std::ios::end);
+        return static_cast<uint64_t>(file.tellg());
+    }
+
+    /**
+     * Writes the operations of a patch in the order of the new image, merging
+     * adjacent operations of the same kind. Literal data is buffered up to a
+     * limit, so memory use doesn't depend on the size of the images.
+    */
+    class Writer
+    {
+        public:
+            Writer (std::FILE* file, patch::Summary& summary) : file(file), summary(summary), type(OP_END), length(0), offset(0) {}
+
+            void copy (uint64_t oldOffset, uint64_t size)
+            {
+                if (size == 0)
+                    return;
+
+                if (this->type != OP_COPY || this->offset + this->length != oldOffset)
+                {
+                    this->flush();
+                    this->type = OP_COPY;
+                    this->offset = oldOffset;
+                }
+
+                this->length += size;
+                this->summary.copied += size;
+            }
+
+            void zeros (uint64_t size)
+            {
+                if (this->type != OP_ZERO)
+                {
+                    this->flush();
+                    this->type = OP_ZERO;
+                }
+
+                this->length += size;
+                this->summary.zeros += size;
+            }
+
+            void data (const char* bytes, std::size_t size)
+            {
+                if (this->type != OP_DATA || this->pending.size() >= MAX_PENDING_DATA)
+                {
+                    this->flush();
+                    this->type = OP_DATA;
+                }
+
+                this->pending.insert(this->pending.end(), bytes, bytes + size);
+                this->length += size;
+                this->summary.literal += size;
+            }
+
+            void flush ()
+            {
+                if (this->type != OP_END && this->length > 0)
+                {
+                    put(this->file, this->type, 1);
+                    put(this->file, this->length, 8);
+                    this->summary.patchSize += 1 + 8;
+
+                    if (this->type == OP_COPY)
+                    {
+                        put(this->file, this->offset, 8);
+                        this->summary.patchSize += 8;
+                    }
+                    else if (this->type == OP_DATA)
+                    {
+                        if (std::fwrite(this->pending.data(), 1, this->pending.size(), this->file) != this->pending.size())
+                            throw new xdvdfs::Exception("Writing the patch failed");
+                        this->summary.patchSize += this->pending.size();
+                    }
+                }
+
+                this->type = OP_END;
+                this->length = 0;
+                this->pending.clear();
+            }
+
+            void finish ()
+            {
+                this->flush();
+                put(this->file, OP_END, 1);
+                this->summary.patchSize += 1;
+            }
+
+        private:
+            std::FILE* file;
+            patch::Summary& summary;
+            Operation type;         ///< operation being collected
+            uint64_t length;
+            uint64_t offset;
+            std::vector<char> pending;
+    };
+
+    /**
+     * Encodes a region of the new image without knowing what it contains:
+     * zero blocks become zeros, blocks equal to the same position of the old
+     * region are copied, everything else is stored. The old region may be
+     * shorter than the new one. Both images are read in large chunks that
+     * are compared sector by sector.
+    */
+    void encodeRaw (std::ifstream& oldFile, uint64_t oldOffset, uint64_t oldSize, std::ifstream& newFile, uint64_t newOffset, uint64_t size,
+                    hash::Crc32& crc, Writer& writer)
+    {
+        std::vector<char> newChunk(CHUNK_SIZE), oldChunk(CHUNK_SIZE);
+
+        for (uint64_t done = 0; done < size; )
+        {
+            std::size_t chunkLength = static_cast<std::size_t>(std::min<uint64_t>(CHUNK_SIZE, size - done));
+            std::size_t oldLength = static_cast<std::size_t>(std::min<uint64_t>(chunkLength, remaining(oldSize, done)));
+
+            readAt(newFile, newOffset + done, newChunk.data(), chunkLength);
+            if (oldLength > 0)
+                readAt(oldFile, oldOffset + done, oldChunk.data(), oldLength);
+
+            crc.update(newChunk.data(), chunkLength);
+
+            for (std::size_t i = 0; i < chunkLength; i += xdvdfs::SECTOR_SIZE)
+            {
+                std::size_t length = std::min<std::size_t>(xdvdfs::SECTOR_SIZE, chunkLength - i);
+                const char* block = newChunk.data() + i;
+
+                if (isZero(block, length))
+                    writer.zeros(length);
+                else if (i + length <= oldLength && std::memcmp(block, oldChunk.data() + i, length) == 0)
+                    writer.copy(oldOffset + done + i, length);
+                else
+                    writer.data(block, length);
+            }
+
+            done += chunkLength;
+        }
+    }
+
+    uint32_t weakHash (const char* data, std::size_t length, uint32_t& a, uint32_t& b)
+    {
+        a = b = 0;
+        for (std::size_t i=0; i<length; ++i)
+        {
+            a += static_cast<unsigned char>(data[i]);
+            b += a;
+        }
+
+        return (a & 0xFFFF) | (b << 16);
+    }
+
+    /**
+     * Encodes a modified file against its old version with rsync-style block
+     * matching: the old file's blocks are indexed by a rolling checksum, so
+     * matches are found at any offset of the new file, e.g. after an insert.
+    */
+    void encodeMatched (const std::vector<char>& oldData, uint64_t oldOffset, const std::vector<char>& newData, Writer& writer)
+    {
+        std::unordered_map<uint32_t, std::vector<uint32_t> > blocks;
+        uint32_t a, b;
+
+        for (std::size_t i=0; i + BLOCK_SIZE <= oldData.size(); i += BLOCK_SIZE)
+            blocks[weakHash(&oldData[i], BLOCK_SIZE, a, b)].push_back(static_cast<uint32_t>(i));
+
+        std::size_t n = newData.size();
+        std::size_t literal = 0;
+        std::size_t i = 0;
+        bool valid = false;
+
+        while (i + BLOCK_SIZE <= n)
+        {
+            if (!valid)
+            {
+                weakHash(&newData[i], BLOCK_SIZE, a, b);
+                valid = true;
+            }
+
+            std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator it = blocks.find((a & 0xFFFF) | (b << 16));
+            std::size_t match = 0;
+            std::size_t matchOffset = 0;
+
+            if (it != blocks.end())
+            {
+                for (std::size_t k=0; k<it->second.size() && match == 0; ++k)
+                {
+                    std::size_t candidate = it->second[k];
+                    if (std::memcmp(&oldData[candidate], &newData[i], BLOCK_SIZE) != 0)
+                        continue;
+
+                    // extend the match as far as the data agrees
+                    match = BLOCK_SIZE;
+                    while (i + match < n && candidate + match < oldData.size() && oldData[candidate + match] == newData[i + match])
+                        ++match;
+                    matchOffset = candidate;
+                }
+            }
+
+            if (match > 0)
+            {
+                if (i > literal)
+                    writer.data(&newData[literal], i - literal);
+
+                writer.copy(oldOffset + matchOffset, match);
+                i += match;
+                literal = i;
+                valid = false;
+                continue;
+            }
+
+            // roll the checksum one byte further
+            if (i + BLOCK_SIZE < n)
+            {
+                uint32_t out = static_cast<unsigned char>(newData[i]);
+                uint32_t in = static_cast<unsigned char>(newData[i + BLOCK_SIZE]);
+                a = a - out + in;
+                b = b - static_cast<uint32_t>(BLOCK_SIZE) * out + a;
+            }
+            ++i;
+        }
+
+        if (n > literal)
+            writer.data(&newData[literal], n - literal);
+    }
+
+    void listFiles (std::ifstream& file, std::map<std::string, Extent>& files, uint64_t imageSize)
+    {
+        xdvdfs::VolumeDescriptor vd;
+        vd.readFromFile(file);
+        vd.validate();
+
+        xdvdfs::TreeWalker walker;
+        walker.walk(file, vd, [&] (const xdvdfs::EntryView& entry) {
+            Extent extent;
+            extent.offset = static_cast<uint64_t>(entry.startSector) * xdvdfs::SECTOR_SIZE;
+            extent.size = entry.fileSize;
+
+            if (!entry.isDirectory() && extent.size > 0 && extent.offset + extent.size <= imageSize)
+            {
+                std::string path = entry.path.str();
+                for (std::size_t i=0; i<path.size(); ++i)
+                    path[i] = std::toupper(static_cast<unsigned char>(path[i]));
+                files[path] = extent;
+            }
+            return true;
+        });
+    }
+}
+
+/**
+ * Creates a patch that turns the old image into the new one. Files are
+ * matched by path using both directory trees: unchanged files are copied
+ * from wherever they are in the old image, changed files are matched block
+ * by block against their old version. Everything else is compared to the
+ * same position in the old image.
+*/
+void patch::create (const std::string& oldFilename, const std::string& newFilename, const std::string& patchFilename, patch::Summary& summary)
+{
+    if (isSameFile(patchFilename, oldFilename) || isSameFile(patchFilename, newFilename))
+        throw new xdvdfs::Exception("The patch must not overwrite one of the images");
+
+    std::ifstream oldFile(oldFilename.c_str(), std::ios::in | std::ios::binary);
+    std::ifstream newFile(newFilename.c_str(), std::ios::in | std::ios::binary);
+    if (!oldFile.is_open() || !newFile.is_open())
+        throw new xdvdfs::Exception("Could not open image");
+
+    oldFile.exceptions(oldFile.failbit | oldFile.badbit | oldFile.eofbit);
+    newFile.exceptions(newFile.failbit | newFile.badbit | newFile.eofbit);
+
+    uint64_t oldSize = fileSize(oldFile);
+    uint64_t newSize = fileSize(newFile);
+
+    std::map<std::string, Extent> oldFiles, newFiles;
+    listFiles(oldFile, oldFiles, oldSize);
+    listFiles(newFile, newFiles, newSize);
+
+    // renamed files are likely to be found among the files of the same size
+    std::map<uint64_t, const Extent*> oldBySize;
+    for (std::map<std::string, Extent>::const_iterator it = oldFiles.begin(); it != oldFiles.end(); ++it)
+        oldBySize.insert(std::make_pair(it->second.size, &it->second));
+
+    // the new image is written in order, so its files are processed by position
+    std::vector<std::pair<Extent, const Extent*> > regions;
+    for (std::map<std::string, Extent>::const_iterator it = newFiles.begin(); it != newFiles.end(); ++it)
+    {
+        std::map<std::string, Extent>::const_iterator old = oldFiles.find(it->first);
+        std::map<uint64_t, const Extent*>::const_iterator sameSize = oldBySize.find(it->second.size);
+
+        const Extent* match = nullptr;
+        if (old != oldFiles.end())
+            match = &old->second;
+        else if (sameSize != oldBySize.end())
+            match = sameSize->second;
+
+        regions.push_back(std::make_pair(it->second, match));
+    }
+
+    std::sort(regions.begin(), regions.end(), [] (const std::pair<Extent, const Extent*>& a, const std::pair<Extent, const Extent*>& b) {
+        return a.first.offset < b.first.offset;
+    });
+
+    std::FILE* file = std::fopen(patchFilename.c_str(), "wb");
+    if (!file)
+        throw new xdvdfs::Exception("Could not create patch file");
+
+    std::memset(&summary, 0, sizeof(summary));
+    hash::Crc32 crc;
+
+    try {
+        std::fwrite(PATCH_MAGIC, 1, sizeof(PATCH_MAGIC), file);
+        put(file, oldSize, 8);
+        put(file, newSize, 8);
+        put(file, 0, 4);    // the CRC is known at the end
+        summary.patchSize = sizeof(PATCH_MAGIC) + 8 + 8 + 4;
+
+        Writer writer(file, summary);
+        uint64_t position = 0;
+        std::vector<char> oldData, newData;
+
+        for (std::size_t i=0; i<regions.size(); ++i)
+        {
+            const Extent& extent = regions[i].first;
+            const Extent* old = regions[i].second;
+
+            // extents overlapping what's been written are damaged, and covered by the raw encoding
+            if (extent.offset < position)
+                continue;
+
+            encodeRaw(oldFile, position, remaining(oldSize, position), newFile, position, extent.offset - position, crc, writer);
+
+            if (old && old->size <= MAX_MATCHED_FILE && extent.size <= MAX_MATCHED_FILE)
+            {
+                oldData.resize(old->size);
+                newData.resize(extent.size);
+                readAt(oldFile, old->offset, oldData.data(), oldData.size());
+                readAt(newFile, extent.offset, newData.data(), newData.size());
+                crc.update(newData.data(), newData.size());
+
+                if (oldData == newData)
+                    writer.copy(old->offset, old->size);
+                else
+                    encodeMatched(oldData, old->offset, newData, writer);
+            }
+            else
+            {
+                // without an old version, the same position is the best guess
+                uint64_t base = old ? old->offset : extent.offset;
+                uint64_t available = old ? old->size : remaining(oldSize, base);
+                encodeRaw(oldFile, base, available, newFile, extent.offset, extent.size, crc, writer);
+            }
+
+            position = extent.offset + extent.size;
+        }
+
+        encodeRaw(oldFile, position, remaining(oldSize, position), newFile, position, newSize - position, crc, writer);
+
+        writer.finish();
+
+        std::fseek(file, sizeof(PATCH_MAGIC) + 16, SEEK_SET);
+        put(file, crc.value(), 4);
+    } catch (...) {
+        std::fclose(file);
+        std::remove(patchFilename.c_str());
+        throw;
+    }
+
+    if (std::fclose(file) != 0)
+        throw new xdvdfs::Exception("Writing the patch failed");
+}
+
+/**
+ * Writes the new image in a single sequential pass over the patch, reading
+ * from the old image where the patch says so. Memory use is bounded by the
+ * streaming buffer.
+*/
+void patch::apply (const std::string& patchFilename, const std::string& oldFilename, const std::string& newFilename)
+{
+    if (isSameFile(newFilename, oldFilename) || isSameFile(newFilename, patchFilename))
+        throw new xdvdfs::Exception("The new image must not overwrite the old image or the patch");
+
+    std::FILE* file = std::fopen(patchFilename.c_str(), "rb");
+    if (!file)
+        throw new xdvdfs::Exception("Could not open patch file");
+
+    // the new image only replaces an existing file once it's complete and verified
+    std::string temporary = newFilename + ".partial-" + std::to_string(getpid());
+    std::ifstream oldFile(oldFilename.c_str(), std::ios::in | std::ios::binary);
+    std::ofstream newFile;
+
+    try {
+        char magic[sizeof(PATCH_MAGIC)];
+        if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || !std::equal(magic, magic + sizeof(magic), PATCH_MAGIC))
+            throw new xdvdfs::Exception("Not a patch file");
+
+        uint64_t oldSize = get(file, 8);
+        uint64_t newSize = get(file, 8);
+        uint32_t expectedCrc = static_cast<uint32_t>(get(file, 4));
+
+        if (!oldFile.is_open())
+            throw new xdvdfs::Exception("Could not open image");
+
+        oldFile.exceptions(oldFile.failbit | oldFile.badbit | oldFile.eofbit);
+        if (fileSize(oldFile) != oldSize)
+            throw new xdvdfs::Exception("The patch doesn't belong to this image");
+
+        newFile.open(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!newFile.is_open())
+            throw new xdvdfs::Exception("Could not create image");
+
+        std::vector<char> buffer(CHUNK_SIZE);
+        hash::Crc32 crc;
+        uint64_t written = 0;
+
+        while (true)
+        {
+            uint64_t type = get(file, 1);
+            if (type == OP_END)
+                break;
+
+            uint64_t length = get(file, 8);
+            uint64_t offset = type == OP_COPY ? get(file, 8) : 0;
+
+            if (type != OP_COPY && type != OP_DATA && type != OP_ZERO)
+                throw new xdvdfs::Exception("Invalid patch operation");
+
+            if (length > newSize - written || (type == OP_COPY && (offset > oldSize || length > oldSize - offset)))
+                throw new xdvdfs::Exception("Patch operation out of range");
+
+            if (type == OP_COPY)
+                oldFile.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+
+            if (type == OP_ZERO)
+                std::fill(buffer.begin(), buffer.end(), 0);
+
+            for (uint64_t done = 0; done < length; )
+            {
+                std::size_t chunk = static_cast<std::size_t>(std::min<uint64_t>(buffer.size(), length - done));
+
+                if (type == OP_COPY)
+                    oldFile.read(buffer.data(), chunk);
+                else if (type == OP_DATA && std::fread(buffer.data(), 1, chunk, file) != chunk)
+                    throw new xdvdfs::Exception("Patch is truncated");
+
+                newFile.write(buffer.data(), chunk);
+                crc.update(buffer.data(), chunk);
+                done += chunk;
+            }
+
+            written += length;
+        }
+
+        newFile.close();
+
+        if (written != newSize || !newFile)
+            throw new xdvdfs::Exception("Writing the new image failed");
+
+        if (crc.value() != expectedCrc)
+            throw new xdvdfs::Exception("The patched image has the wrong checksum");
+
+        if (!replaceFile(temporary, newFilename))
+            throw new xdvdfs::Exception("Could not replace the new image");
+    } catch (...) {
+        std::fclose(file);
+        if (newFile.is_open())
+            newFile.close();
+        std::remove(temporary.c_str());
+        throw;
+    }
+
+    std::fclose(file);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace patch
+{
+    /**
+     * What a patch is made of, in bytes of the new image.
+    */
+    struct Summary
+    {
+        uint64_t copied;        ///< taken from the old image
+        uint64_t zeros;
+        uint64_t literal;       ///< stored in the patch
+        uint64_t patchSize;
+    };
+
+    void create (const std::string& oldFilename, const std::string& newFilename, const std::string& patchFilename, Summary& summary);
+    void apply (const std::string& patchFilename, const std::string& oldFilename, const std::string& newFilename);
+}
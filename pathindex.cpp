@@ -0,0 +1,413 @@
+#include "pathindex.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <exception>
+#include <thread>
+#include <sys/stat.h>
+
+namespace {
+    const char INDEX_MAGIC[8] = {'X', 'B', 'I', 'D', 'X', '0', '0', '1'};
+    const uint64_t HEADER_BYTES = sizeof(INDEX_MAGIC) + 8 + 8 + 4 + 4;
+    const uint64_t ENTRY_BYTES = 4 + 4 + 1 + 4 + 4;
+
+    /**
+     * The entries found below one directory, collected by one thread.
+    */
+    struct Partial
+    {
+        std::vector<xdvdfs::PathIndex::Entry> entries;
+        std::vector<uint64_t> hashes;
+        std::vector<char> paths;
+    };
+
+    void addEntry (Partial& partial, const char* path, std::size_t length, uint32_t sector, uint32_t size, uint8_t attributes)
+    {
+        xdvdfs::PathIndex::Entry entry;
+        entry.startSector = sector;
+        entry.fileSize = size;
+        entry.attributes = attributes;
+        entry.pathOffset = static_cast<uint32_t>(partial.paths.size());
+        entry.pathLength = static_cast<uint32_t>(length);
+
+        partial.entries.push_back(entry);
+        partial.hashes.push_back(xdvdfs::PathIndex::hash(path, length));
+        partial.paths.insert(partial.paths.end(), path, path + length);
+    }
+
+    bool imageIdentity (const std::string& filename, uint64_t& size, uint64_t& time)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0)
+            return false;
+
+        size = static_cast<uint64_t>(st.st_size);
+        time = static_cast<uint64_t>(st.st_mtime);
+        return true;
+    }
+
+    void put (std::FILE* file, uint64_t value, int bytes)
+    {
+        char buffer[8];
+        for (int i=0; i<bytes; ++i)
+            buffer[i] = static_cast<char>(value >> (i*8));
+        std::fwrite(buffer, 1, bytes, file);
+    }
+
+    bool get (std::FILE* file, uint64_t& value, int bytes)
+    {
+        unsigned char buffer[8];
+        if (std::fread(buffer, 1, bytes, file) != static_cast<std::size_t>(bytes))
+            return false;
+
+        value = 0;
+        for (int i=0; i<bytes; ++i)
+            value |= static_cast<uint64_t>(buffer[i]) << (i*8);
+        return true;
+    }
+}
+
+/**
+ * FNV-1a over the upper case bytes, so names differing only in case collide
+ * on purpose.
+*/
+uint64_t xdvdfs::PathIndex::hash (const char* path, std::size_t length)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (std::size_t i=0; i<length; ++i)
+    {
+        h ^= static_cast<uint64_t>(std::toupper(static_cast<unsigned char>(path[i])));
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+std::string xdvdfs::PathIndex::sidecarFilename (const std::string& filename)
+{
+    return filename + ".xbidx";
+}
+
+/**
+ * Builds the index from the image. The subdirectories of the root directory
+ * are walked in parallel, each thread with its own stream.
+*/
+void xdvdfs::PathIndex::build (const std::string& filename, unsigned int threads)
+{
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        throw new xdvdfs::Exception("Could not open image");
+
+    file.exceptions(file.failbit | file.badbit | file.eofbit);
+
+    if (!imageIdentity(filename, this->imageSize, this->imageTime))
+        throw new xdvdfs::Exception("Could not stat image");
+
+    xdvdfs::VolumeDescriptor vd;
+    vd.readFromFile(file);
+    vd.validate();
+
+    xdvdfs::DirectoryTable root;
+    root.read(file, vd.getRootDirTableSector(), vd.getRootDirTableSize());
+
+    Partial top;
+    std::vector<std::size_t> subdirs;
+
+    for (std::size_t i=0; i<root.size(); ++i)
+    {
+        xdvdfs::NameView name = root.name(i);
+        addEntry(top, name.data, name.size, root.sectors[i], root.sizes[i], root.attributes[i]);
+
+        if (root.isDirectory(i) && root.sizes[i] > 0)
+            subdirs.push_back(i);
+    }
+
+    std::vector<Partial> partials(subdirs.size());
+    std::vector<std::exception_ptr> errors(subdirs.size());
+    std::atomic<std::size_t> next(0);
+
+    auto worker = [&] {
+        std::ifstream stream(filename.c_str(), std::ios::in | std::ios::binary);
+        xdvdfs::TreeWalker walker;
+        std::string prefix;
+        std::string path;
+
+        for (std::size_t job = next++; job < subdirs.size(); job = next++)
+        {
+            std::size_t i = subdirs[job];
+
+            try {
+                if (!stream.is_open())
+                    throw new xdvdfs::Exception("Could not open image");
+
+                stream.exceptions(stream.failbit | stream.badbit | stream.eofbit);
+
+                xdvdfs::NameView name = root.name(i);
+                prefix.assign(name.data, name.size);
+                prefix += '/';
+
+                Partial& partial = partials[job];
+                walker.walk(stream, root.sectors[i], root.sizes[i], [&] (const xdvdfs::EntryView& entry) {
+                    path.assign(prefix);
+                    path.append(entry.path.data, entry.path.size);
+                    addEntry(partial, path.data(), path.size(), entry.startSector, entry.fileSize, entry.attributes);
+                    return true;
+                });
+            } catch (...) {
+                errors[job] = std::current_exception();
+                stream.clear();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    unsigned int count = std::min<std::size_t>(std::max(1u, threads), subdirs.size());
+    for (unsigned int t=1; t<count; ++t)
+        pool.push_back(std::thread(worker));
+
+    worker();
+
+    for (std::size_t t=0; t<pool.size(); ++t)
+        pool[t].join();
+
+    for (std::size_t i=0; i<errors.size(); ++i)
+    {
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+    }
+
+    // merge the partial results, moving the path offsets along
+    this->entries.swap(top.entries);
+    this->hashes.swap(top.hashes);
+    this->paths.swap(top.paths);
+
+    for (std::size_t i=0; i<partials.size(); ++i)
+    {
+        uint32_t base = static_cast<uint32_t>(this->paths.size());
+
+        for (std::size_t j=0; j<partials[i].entries.size(); ++j)
+        {
+            partials[i].entries[j].pathOffset += base;
+            this->entries.push_back(partials[i].entries[j]);
+        }
+
+        this->hashes.insert(this->hashes.end(), partials[i].hashes.begin(), partials[i].hashes.end());
+        this->paths.insert(this->paths.end(), partials[i].paths.begin(), partials[i].paths.end());
+    }
+
+    this->buildTable();
+}
+
+/**
+ * Sets up the open addressing table with at most 50% load, so lookups
+ * usually find their entry in the first slot.
+*/
+void xdvdfs::PathIndex::buildTable ()
+{
+    std::size_t capacity = 16;
+    while (capacity < this->entries.size() * 2)
+        capacity *= 2;
+
+    this->slots.assign(capacity, 0);
+    std::size_t mask = capacity - 1;
+
+    for (std::size_t i=0; i<this->entries.size(); ++i)
+    {
+        std::size_t slot = this->hashes[i] & mask;
+        while (this->slots[slot] != 0)
+            slot = (slot + 1) & mask;
+
+        this->slots[slot] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+/**
+ * Finds the entry of a path relative to the root directory, using '/' as
+ * separator. Repeated, leading and trailing separators are ignored, like
+ * when walking the directory tables. Returns null if there is no such entry.
+*/
+const xdvdfs::PathIndex::Entry* xdvdfs::PathIndex::find (const std::string& path) const
+{
+    if (this->slots.empty())
+        return nullptr;
+
+    std::size_t begin = path.find_first_not_of('/');
+    std::size_t end = path.find_last_not_of('/');
+    if (begin == std::string::npos)
+        return nullptr;
+
+    const char* p = path.data() + begin;
+    std::size_t length = end - begin + 1;
+
+    std::string collapsed;
+    if (path.find("//", begin) < end)
+    {
+        for (std::size_t i=begin; i<=end; ++i)
+        {
+            if (path[i] != '/' || path[i-1] != '/')
+                collapsed += path[i];
+        }
+
+        p = collapsed.data();
+        length = collapsed.size();
+    }
+
+    uint64_t h = hash(p, length);
+    std::size_t mask = this->slots.size() - 1;
+
+    for (std::size_t slot = h & mask; this->slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const Entry& entry = this->entries[this->slots[slot] - 1];
+        if (this->hashes[this->slots[slot] - 1] != h || entry.pathLength != length)
+            continue;
+
+        const char* candidate = this->paths.data() + entry.pathOffset;
+        std::size_t i = 0;
+        while (i < length && std::toupper(static_cast<unsigned char>(candidate[i])) == std::toupper(static_cast<unsigned char>(p[i])))
+            ++i;
+
+        if (i == length)
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+std::string xdvdfs::PathIndex::path (const xdvdfs::PathIndex::Entry& entry) const
+{
+    return std::string(this->paths.data() + entry.pathOffset, entry.pathLength);
+}
+
+/**
+ * Writes the index in a little-endian format, so it can be shared between
+ * hosts.
+*/
+void xdvdfs::PathIndex::save (const std::string& indexFilename) const
+{
+    std::FILE* file = std::fopen(indexFilename.c_str(), "wb");
+    if (!file)
+        throw new xdvdfs::Exception("Could not write index file");
+
+    std::fwrite(INDEX_MAGIC, 1, sizeof(INDEX_MAGIC), file);
+    put(file, this->imageSize, 8);
+    put(file, this->imageTime, 8);
+    put(file, this->entries.size(), 4);
+    put(file, this->paths.size(), 4);
+
+    for (std::size_t i=0; i<this->entries.size(); ++i)
+    {
+        const Entry& entry = this->entries[i];
+        put(file, entry.startSector, 4);
+        put(file, entry.fileSize, 4);
+        put(file, entry.attributes, 1);
+        put(file, entry.pathOffset, 4);
+        put(file, entry.pathLength, 4);
+    }
+
+    std::fwrite(this->paths.data(), 1, this->paths.size(), file);
+
+    bool failed = std::ferror(file) != 0;
+    if (std::fclose(file) != 0 || failed)
+        throw new xdvdfs::Exception("Could not write index file");
+}
+
+/**
+ * Loads an index written by save. Returns false if the file doesn't exist,
+ * is damaged or belongs to a different version of the image.
+*/
+bool xdvdfs::PathIndex::load (const std::string& filename, const std::string& indexFilename)
+{
+    uint64_t size, time;
+    if (!imageIdentity(filename, size, time))
+        return false;
+
+    std::FILE* file = std::fopen(indexFilename.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[sizeof(INDEX_MAGIC)];
+    uint64_t indexSize, indexTime, count, pathBytes;
+    bool valid = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+        && std::equal(magic, magic + sizeof(magic), INDEX_MAGIC)
+        && get(file, indexSize, 8) && get(file, indexTime, 8) && indexSize == size && indexTime == time
+        && get(file, count, 4) && get(file, pathBytes, 4);
+
+    // the counts are checked against the file size before anything gets allocated for them
+    if (valid)
+    {
+        valid = std::fseek(file, 0, SEEK_END) == 0
+            && static_cast<uint64_t>(std::ftell(file)) == HEADER_BYTES + count * ENTRY_BYTES + pathBytes
+            && std::fseek(file, HEADER_BYTES, SEEK_SET) == 0;
+    }
+
+    std::vector<Entry> entries;
+    std::vector<uint64_t> hashes;
+    std::vector<char> paths;
+
+    if (valid)
+    {
+        entries.resize(count);
+        for (std::size_t i=0; valid && i<count; ++i)
+        {
+            uint64_t sector, fileSize, attributes, offset, length;
+            valid = get(file, sector, 4) && get(file, fileSize, 4) && get(file, attributes, 1)
+                && get(file, offset, 4) && get(file, length, 4) && offset + length <= pathBytes;
+
+            entries[i].startSector = static_cast<uint32_t>(sector);
+            entries[i].fileSize = static_cast<uint32_t>(fileSize);
+            entries[i].attributes = static_cast<uint8_t>(attributes);
+            entries[i].pathOffset = static_cast<uint32_t>(offset);
+            entries[i].pathLength = static_cast<uint32_t>(length);
+        }
+    }
+
+    if (valid)
+    {
+        paths.resize(pathBytes);
+        valid = std::fread(paths.data(), 1, paths.size(), file) == paths.size();
+    }
+
+    std::fclose(file);
+
+    if (!valid)
+        return false;
+
+    // the hashes are cheap to recompute and not worth storing
+    hashes.resize(entries.size());
+    for (std::size_t i=0; i<entries.size(); ++i)
+        hashes[i] = hash(paths.data() + entries[i].pathOffset, entries[i].pathLength);
+
+    this->entries.swap(entries);
+    this->hashes.swap(hashes);
+    this->paths.swap(paths);
+    this->imageSize = size;
+    this->imageTime = time;
+    this->buildTable();
+    return true;
+}
+
+/**
+ * Loads the index from the sidecar file of the image, or builds it and tries
+ * to store it there for the next time. Returns whether it was loaded.
+*/
+bool xdvdfs::PathIndex::loadOrBuild (const std::string& filename, unsigned int threads)
+{
+    std::string sidecar = sidecarFilename(filename);
+    if (this->load(filename, sidecar))
+        return true;
+
+    this->build(filename, threads);
+
+    // a read-only location only costs rebuilding the index next time
+    try {
+        this->save(sidecar);
+    } catch (xdvdfs::Exception* e) {
+        delete e;
+        std::remove(sidecar.c_str());
+    }
+
+    return false;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "xdvdfs.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xdvdfs
+{
+    /**
+     * A hash table of the full paths of all entries in an image, so that any
+     * path resolves with a single probe instead of descending a directory
+     * table per component. Paths are hashed and compared case-insensitively,
+     * like the directory tables are sorted. The index can be stored in a
+     * sidecar file next to the image and is rebuilt when the image changes.
+    */
+    class PathIndex
+    {
+        public:
+            struct Entry
+            {
+                uint32_t startSector;
+                uint32_t fileSize;
+                uint8_t attributes;
+                uint32_t pathOffset;        ///< position of the path in the path buffer
+                uint32_t pathLength;
+
+                bool isDirectory () const { return (this->attributes & DirectoryEntry::FILE_DIRECTORY) != 0; }
+            };
+
+            PathIndex () : imageSize(0), imageTime(0) {}
+
+            void build (const std::string& filename, unsigned int threads);
+            bool load (const std::string& filename, const std::string& indexFilename);
+            void save (const std::string& indexFilename) const;
+            bool loadOrBuild (const std::string& filename, unsigned int threads);
+
+            const Entry* find (const std::string& path) const;
+            std::string path (const Entry& entry) const;
+            std::size_t size () const { return this->entries.size(); }
+
+            static std::string sidecarFilename (const std::string& filename);
+            static uint64_t hash (const char* path, std::size_t length);
+
+        private:
+            void buildTable ();
+
+            std::vector<Entry> entries;
+            std::vector<uint64_t> hashes;   ///< hash of each entry's path
+            std::vector<char> paths;
+            std::vector<uint32_t> slots;    ///< entry index + 1 per slot, 0 if empty; the size is a power of two
+            uint64_t imageSize;             ///< identify the image the index belongs to
+            uint64_t imageTime;
+    };
+}
@@ -0,0 +1,109 @@
+#include "progress.hpp"
+
+#include <cstdio>
+
+void Progress::start (std::chrono::milliseconds interval)
+{
+    this->interval = interval;
+    this->begin = Clock::now();
+    this->running = true;
+    this->thread = std::thread(&Progress::report, this);
+}
+
+/**
+ * Stops the reporter thread after printing the final state.
+*/
+void Progress::stop ()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->running)
+            return;
+
+        this->running = false;
+    }
+
+    this->stopped.notify_all();
+    this->thread.join();
+}
+
+void Progress::report ()
+{
+    // rates are smoothed, so a single slow file doesn't make the estimate jump
+    const double smoothing = 0.3;
+    uint64_t lastBytes = 0;
+    uint64_t lastFiles = 0;
+    Clock::time_point last = this->begin;
+    double bytesPerSecond = 0;
+    double filesPerSecond = 0;
+    bool first = true;
+    bool finished = false;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (!finished)
+    {
+        finished = this->stopped.wait_for(lock, this->interval, [this] { return !this->running; });
+
+        Clock::time_point now = Clock::now();
+        uint64_t bytes = this->doneBytes.load(std::memory_order_relaxed);
+        uint64_t files = this->doneFiles.load(std::memory_order_relaxed);
+
+        // the final line shows the averages of the whole run
+        if (finished)
+        {
+            lastBytes = lastFiles = 0;
+            last = this->begin;
+            first = true;
+        }
+
+        double seconds = std::chrono::duration<double>(now - last).count();
+        if (seconds > 0)
+        {
+            double currentBytes = (bytes - lastBytes) / seconds;
+            double currentFiles = (files - lastFiles) / seconds;
+
+            bytesPerSecond = first ? currentBytes : smoothing * currentBytes + (1 - smoothing) * bytesPerSecond;
+            filesPerSecond = first ? currentFiles : smoothing * currentFiles + (1 - smoothing) * filesPerSecond;
+            first = false;
+        }
+
+        lastBytes = bytes;
+        lastFiles = files;
+        last = now;
+
+        this->print(bytesPerSecond, filesPerSecond, finished);
+    }
+}
+
+void Progress::print (double bytesPerSecond, double filesPerSecond, bool last)
+{
+    uint64_t total = this->totalBytes.load(std::memory_order_relaxed);
+    uint64_t done = this->doneBytes.load(std::memory_order_relaxed);
+    uint64_t totalFiles = this->totalFiles.load(std::memory_order_relaxed);
+    uint64_t doneFiles = this->doneFiles.load(std::memory_order_relaxed);
+    const double mb = 1024.0 * 1024.0;
+
+    // rewritten files can make the work done exceed the precomputed total
+    if (done > total)
+        total = done;
+
+    char eta[32] = "--:--:--";
+    if (last)
+    {
+        unsigned long elapsed = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - this->begin).count();
+        std::snprintf(eta, sizeof(eta), "%lu:%02lu:%02lu", elapsed / 3600, elapsed / 60 % 60, elapsed % 60);
+    }
+    else if (bytesPerSecond > 0)
+    {
+        unsigned long remaining = static_cast<unsigned long>((total - done) / bytesPerSecond);
+        std::snprintf(eta, sizeof(eta), "%lu:%02lu:%02lu", remaining / 3600, remaining / 60 % 60, remaining % 60);
+    }
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%.1f/%.1f MiB (%3.0f%%), %llu/%llu files, %.1f MB/s, %.0f files/s, %s %s",
+                  done / mb, total / mb, total > 0 ? 100.0 * done / total : 100.0,
+                  static_cast<unsigned long long>(doneFiles), static_cast<unsigned long long>(totalFiles),
+                  bytesPerSecond / mb, filesPerSecond, last ? "elapsed" : "ETA", eta);
+    this->logger.status(line, last);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/**
+ * This class shows the progress of an extraction as the status line of the
+ * logger. Workers only increment atomic counters; a separate thread reads
+ * them at a fixed interval and reports the bytes done, the current
+ * throughput and the estimated time remaining.
+*/
+class Progress
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        explicit Progress (Logger& logger) : logger(logger), totalBytes(0), totalFiles(0), doneBytes(0), doneFiles(0), running(false) {}
+        ~Progress () { this->stop(); }
+
+        void addTotal (uint64_t bytes, uint64_t files)
+        {
+            this->totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+            this->totalFiles.fetch_add(files, std::memory_order_relaxed);
+        }
+
+        void addBytes (uint64_t bytes) { this->doneBytes.fetch_add(bytes, std::memory_order_relaxed); }
+        void addFile () { this->doneFiles.fetch_add(1, std::memory_order_relaxed); }
+
+        void start (std::chrono::milliseconds interval);
+        void stop ();
+
+    private:
+        void report ();
+        void print (double bytesPerSecond, double filesPerSecond, bool last);
+
+        Logger& logger;
+        std::atomic<uint64_t> totalBytes;
+        std::atomic<uint64_t> totalFiles;
+        std::atomic<uint64_t> doneBytes;
+        std::atomic<uint64_t> doneFiles;
+
+        std::chrono::milliseconds interval;
+        Clock::time_point begin;
+        bool running;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable stopped;
+};
@@ -0,0 +1,106 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <sys/stat.h>
+
+Scheduler::Scheduler (unsigned int workers, unsigned int jobsPerDevice) :
+    workers(std::max(1u, workers)), jobsPerDevice(std::max(1u, jobsPerDevice))
+{
+}
+
+void Scheduler::addJob (const std::string& source, const std::string& destination, const std::function<void ()>& job)
+{
+    Job j;
+    j.run = job;
+    j.source = device(source);
+    j.destination = device(destination);
+
+    this->pending.push_back(j);
+}
+
+/**
+ * Returns the device a path is on. A path that doesn't exist yet, like an
+ * output directory, is on the device of its closest existing parent. Paths
+ * whose device can't be determined share a single queue.
+*/
+uint64_t Scheduler::device (const std::string& path)
+{
+    std::string existing = path;
+    struct stat st;
+
+    while (stat(existing.c_str(), &st) != 0)
+    {
+        if (existing == "." || existing == "/")
+            return 0;
+
+        std::size_t separator = existing.find_last_of("/\\");
+        if (separator == std::string::npos)
+            existing = ".";
+        else if (separator == 0)
+            existing = "/";
+        else
+            existing = existing.substr(0, separator);
+    }
+
+    return static_cast<uint64_t>(st.st_dev);
+}
+
+void Scheduler::run ()
+{
+    std::vector<std::thread> threads;
+    unsigned int count = std::min<std::size_t>(this->workers, this->pending.size());
+
+    for (unsigned int i=0; i<count; ++i)
+        threads.push_back(std::thread(&Scheduler::worker, this));
+
+    for (std::size_t i=0; i<threads.size(); ++i)
+        threads[i].join();
+}
+
+/**
+ * Waits for the first pending job whose devices aren't busy, in the order the
+ * jobs were added. Returns false when all jobs have been taken.
+*/
+bool Scheduler::takeJob (Scheduler::Job& job)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (!this->pending.empty())
+    {
+        for (std::vector<Job>::iterator it = this->pending.begin(); it != this->pending.end(); ++it)
+        {
+            if (this->running[it->source] < this->jobsPerDevice && this->running[it->destination] < this->jobsPerDevice)
+            {
+                job = *it;
+                this->pending.erase(it);
+
+                ++this->running[job.source];
+                if (job.destination != job.source)
+                    ++this->running[job.destination];
+
+                return true;
+            }
+        }
+
+        this->finished.wait(lock);
+    }
+
+    return false;
+}
+
+void Scheduler::worker ()
+{
+    Job job;
+
+    while (this->takeJob(job))
+    {
+        job.run();
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        --this->running[job.source];
+        if (job.destination != job.source)
+            --this->running[job.destination];
+        this->finished.notify_all();
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * This class runs jobs that each read one file and write to one directory on
+ * a pool of worker threads. The number of jobs running concurrently on the
+ * same device, whether they read from it or write to it, is limited, so files
+ * on different disks are processed in parallel while files on the same disk
+ * don't compete for it.
+*/
+class Scheduler
+{
+    public:
+        Scheduler (unsigned int workers, unsigned int jobsPerDevice);
+
+        void addJob (const std::string& source, const std::string& destination, const std::function<void ()>& job);
+        void run ();
+
+    private:
+        struct Job
+        {
+            uint64_t source;        ///< devices the job reads from and writes to
+            uint64_t destination;
+            std::function<void ()> run;
+        };
+
+        static uint64_t device (const std::string& path);
+        bool takeJob (Job& job);
+        void worker ();
+
+        unsigned int workers;
+        unsigned int jobsPerDevice;
+        std::vector<Job> pending;
+        std::map<uint64_t, unsigned int> running;   ///< number of running jobs by device
+        std::mutex mutex;
+        std::condition_variable finished;
+};
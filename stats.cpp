@@ -0,0 +1,61 @@
+#include "stats.hpp"
+
+#include <cstdio>
+
+Statistics::Statistics () :
+    begin(Clock::now()), bytesRead(0), bytesWritten(0), readChunks(0), writeChunks(0), files(0), directories(0)
+{
+    for (int i=0; i<PHASE_COUNT; ++i)
+        this->seconds[i] = 0;
+}
+
+/**
+ * Formats the statistics as a block of lines, so that reports of images
+ * extracted in parallel don't get mixed up.
+*/
+std::string Statistics::report (const std::string& name) const
+{
+    static const char* names[PHASE_COUNT] = {
+        "volume descriptor", "tree traversal", "directory creation", "file open", "data read", "data write"
+    };
+
+    double total = std::chrono::duration<double>(Clock::now() - this->begin).count();
+    double other = total;
+    std::string result = "statistics for " + name + ":\n";
+    char line[128];
+
+    for (int i=0; i<PHASE_COUNT; ++i)
+    {
+        std::snprintf(line, sizeof(line), "  %-20s %10.3f s %6.1f %%\n", names[i], this->seconds[i],
+                      total > 0 ? 100.0 * this->seconds[i] / total : 0.0);
+        result += line;
+        other -= this->seconds[i];
+    }
+
+    std::snprintf(line, sizeof(line), "  %-20s %10.3f s %6.1f %%\n", "other", other > 0 ? other : 0.0,
+                  total > 0 && other > 0 ? 100.0 * other / total : 0.0);
+    result += line;
+
+    std::snprintf(line, sizeof(line), "  %-20s %10.3f s\n", "total", total);
+    result += line;
+
+    std::snprintf(line, sizeof(line), "  %llu files, %llu directories\n",
+                  static_cast<unsigned long long>(this->files), static_cast<unsigned long long>(this->directories));
+    result += line;
+
+    std::snprintf(line, sizeof(line), "  read:  %14llu bytes in %10llu chunks, %9.1f MB/s\n",
+                  static_cast<unsigned long long>(this->bytesRead), static_cast<unsigned long long>(this->readChunks),
+                  this->seconds[READ] > 0 ? this->bytesRead / this->seconds[READ] / (1024.0*1024.0) : 0.0);
+    result += line;
+
+    std::snprintf(line, sizeof(line), "  write: %14llu bytes in %10llu chunks, %9.1f MB/s\n",
+                  static_cast<unsigned long long>(this->bytesWritten), static_cast<unsigned long long>(this->writeChunks),
+                  this->seconds[WRITE] > 0 ? this->bytesWritten / this->seconds[WRITE] / (1024.0*1024.0) : 0.0);
+    result += line;
+
+    std::snprintf(line, sizeof(line), "  overall %.1f MB/s\n",
+                  total > 0 ? this->bytesRead / total / (1024.0*1024.0) : 0.0);
+    result += line;
+
+    return result;
+}
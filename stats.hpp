@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * Time spent in the phases of an extraction and I/O counters. Every image
+ * has its own instance, so no synchronization is needed.
+*/
+struct Statistics
+{
+    typedef std::chrono::steady_clock Clock;
+
+    enum Phase {VOLUME_DESCRIPTOR, TRAVERSAL, DIRECTORIES, OPEN, READ, WRITE, PHASE_COUNT};
+
+    Statistics ();
+
+    void add (Phase phase, Clock::time_point start)
+    {
+        this->seconds[phase] += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    std::string report (const std::string& name) const;
+
+    /**
+     * Adds the time until it goes out of scope to a phase.
+    */
+    class Timer
+    {
+        public:
+            Timer (Statistics& stats, Phase phase) : stats(stats), phase(phase), start(Clock::now()) {}
+            ~Timer () { this->stats.add(this->phase, this->start); }
+
+        private:
+            Statistics& stats;
+            Phase phase;
+            Clock::time_point start;
+    };
+
+    Clock::time_point begin;
+    double seconds[PHASE_COUNT];
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t readChunks;            ///< chunks copied, not system calls, which depend on the stream buffers
+    uint64_t writeChunks;
+    uint64_t files;
+    uint64_t directories;
+};
@@ -0,0 +1,569 @@
+#include "store.hpp"
+#include "xdvdfs.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#if defined _WIN32
+    #include "direct.h"
+    #include <process.h>
+    #define NOMINMAX
+    #include <windows.h>
+    #define mkdir(a,b) _mkdir(a)
+    #define getpid _getpid
+#else
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/*
+ * A store keeps the files of many images as blobs named by their SHA-1, so
+ * every distinct file is stored once. Each image has a manifest listing its
+ * files and runs of zeros by offset; all other bytes of the image (volume
+ * descriptor, directory tables, padding) are concatenated into a residual
+ * blob. The manifest is a text file:
+ *
+ *   xbiso-store 1
+ *   source <path of the exported image>
+ *   image <size> <sha1>
+ *   residual <size> <sha1>
+ *   zero <offset> <length>
+ *   file <offset> <size> <sha1> <path>
+ *
+ * with the zero and file lines ordered by offset. Manifests are named after
+ * the image, so exporting another image with the same name is refused.
+ */
+
+namespace {
+    const std::size_t CHUNK_SIZE = 64 * 1024;
+    const uint64_t MAX_BUFFERED_FILE = 64 * 1024 * 1024;   ///< larger files are read twice instead of being held in memory
+
+    struct Segment
+    {
+        bool zero;
+        uint64_t offset;
+        uint64_t size;
+        std::string sha1;
+        std::string path;
+    };
+
+    std::string blobDirectory (const std::string& storeDirectory, const std::string& sha1)
+    {
+        return storeDirectory + "/blobs/" + sha1.substr(0, 2);
+    }
+
+    std::string blobFilename (const std::string& storeDirectory, const std::string& sha1)
+    {
+        return blobDirectory(storeDirectory, sha1) + "/" + sha1;
+    }
+
+    bool exists (const std::string& filename)
+    {
+        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+        return file.is_open();
+    }
+
+    /**
+     * Returns a name for a temporary file in the store that no other export,
+     * also not one running in another process, uses at the same time.
+    */
+    std::string temporaryFilename (const std::string& storeDirectory)
+    {
+        static std::atomic<unsigned int> counter(0);
+        return storeDirectory + "/blobs/incoming-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    }
+
+    std::string absolutePath (const std::string& filename)
+    {
+#if defined _WIN32
+        char path[_MAX_PATH];
+        if (_fullpath(path, filename.c_str(), _MAX_PATH))
+            return path;
+#else
+        char path[PATH_MAX];
+        if (realpath(filename.c_str(), path))
+            return path;
+#endif
+        return filename;
+    }
+
+    /**
+     * Returns the size of a file, or false if it can't be opened.
+    */
+    bool blobSize (const std::string& filename, uint64_t& size)
+    {
+        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return false;
+
+        size = static_cast<uint64_t>(file.tellg());
+        return true;
+    }
+
+    /**
+     * Moves a completely written temporary file over the target, which may
+     * exist already.
+    */
+    bool replaceFile (const std::string& temporary, const std::string& target)
+    {
+#if defined _WIN32
+        return MoveFileExA(temporary.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(temporary.c_str(), target.c_str()) == 0;
+#endif
+    }
+
+    void readAt (std::ifstream& file, uint64_t offset, char* data, std::size_t length)
+    {
+        file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        file.read(data, length);
+    }
+
+    /**
+     * Moves a completely written temporary file to its blob name. Another
+     * export may have stored the same blob in the meantime; as blobs are
+     * named by their content, either copy is fine.
+    */
+    void commitBlob (const std::string& storeDirectory, const std::string& temporary, const std::string& sha1)
+    {
+        mkdir(blobDirectory(storeDirectory, sha1).c_str(), 0755);
+
+        std::string filename = blobFilename(storeDirectory, sha1);
+        if (exists(filename))
+        {
+            std::remove(temporary.c_str());
+            return;
+        }
+
+        if (std::rename(temporary.c_str(), filename.c_str()) != 0)
+        {
+            std::remove(temporary.c_str());
+            if (!exists(filename))
+                throw new xdvdfs::Exception("Could not store blob");
+        }
+    }
+
+    /**
+     * Stores a file of the image as a blob, unless the store already has it.
+     * Small files are hashed and written from memory; larger ones are hashed
+     * first and only read a second time if they have to be written.
+    */
+    void storeFile (std::ifstream& image, Segment& segment, const std::string& storeDirectory, hash::Sha1& imageHash, store::Summary& summary)
+    {
+        std::string temporary = temporaryFilename(storeDirectory);
+        hash::Sha1 sha1;
+
+        if (segment.size <= MAX_BUFFERED_FILE)
+        {
+            std::vector<char> data(segment.size);
+            readAt(image, segment.offset, data.data(), data.size());
+            sha1.update(data.data(), data.size());
+            imageHash.update(data.data(), data.size());
+            segment.sha1 = sha1.hexdigest();
+
+            if (exists(blobFilename(storeDirectory, segment.sha1)))
+            {
+                summary.bytesShared += segment.size;
+                return;
+            }
+
+            std::ofstream blob(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            blob.write(data.data(), data.size());
+            blob.close();
+            if (!blob)
+            {
+                std::remove(temporary.c_str());
+                throw new xdvdfs::Exception("Could not write blob");
+            }
+        }
+        else
+        {
+            std::vector<char> buffer(CHUNK_SIZE);
+
+            image.seekg(static_cast<std::streamoff>(segment.offset), std::ios::beg);
+            for (uint64_t done = 0; done < segment.size; )
+            {
+                std::size_t length = static_cast<std::size_t>(std::min<uint64_t>(buffer.size(), segment.size - done));
+                image.read(buffer.data(), length);
+                sha1.update(buffer.data(), length);
+                imageHash.update(buffer.data(), length);
+                done += length;
+            }
+
+            segment.sha1 = sha1.hexdigest();
+
+            if (exists(blobFilename(storeDirectory, segment.sha1)))
+            {
+                summary.bytesShared += segment.size;
+                return;
+            }
+
+            std::ofstream blob(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            image.seekg(static_cast<std::streamoff>(segment.offset), std::ios::beg);
+            for (uint64_t done = 0; done < segment.size; )
+            {
+                std::size_t length = static_cast<std::size_t>(std::min<uint64_t>(buffer.size(), segment.size - done));
+                image.read(buffer.data(), length);
+                blob.write(buffer.data(), length);
+                done += length;
+            }
+
+            blob.close();
+            if (!blob)
+            {
+                std::remove(temporary.c_str());
+                throw new xdvdfs::Exception("Could not write blob");
+            }
+        }
+
+        commitBlob(storeDirectory, temporary, segment.sha1);
+        ++summary.blobsWritten;
+        summary.bytesWritten += segment.size;
+    }
+
+    /**
+     * Splits a region of the image that doesn't belong to a file into runs
+     * of zero sectors, which only go into the manifest, and other data, which
+     * is appended to the residual.
+    */
+    void storeGap (std::ifstream& image, uint64_t offset, uint64_t size, std::vector<Segment>& segments,
+                   std::ofstream& residual, hash::Sha1& residualHash, hash::Sha1& imageHash)
+    {
+        std::vector<char> block(xdvdfs::SECTOR_SIZE);
+        static const char zeros[xdvdfs::SECTOR_SIZE] = {0};
+
+        image.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+
+        for (uint64_t done = 0; done < size; )
+        {
+            std::size_t length = static_cast<std::size_t>(std::min<uint64_t>(block.size(), size - done));
+            image.read(block.data(), length);
+            imageHash.update(block.data(), length);
+
+            if (std::memcmp(block.data(), zeros, length) == 0)
+            {
+                if (!segments.empty() && segments.back().zero && segments.back().offset + segments.back().size == offset + done)
+                {
+                    segments.back().size += length;
+                }
+                else
+                {
+                    Segment segment;
+                    segment.zero = true;
+                    segment.offset = offset + done;
+                    segment.size = length;
+                    segments.push_back(segment);
+                }
+            }
+            else
+            {
+                residual.write(block.data(), length);
+                residualHash.update(block.data(), length);
+            }
+
+            done += length;
+        }
+    }
+
+    /**
+     * Makes sure a manifest, if there is one already, belongs to the image
+     * being exported, so that images with the same name from different
+     * directories don't silently replace each other.
+    */
+    void checkManifestSource (const std::string& manifestFilename, const std::string& source)
+    {
+        std::ifstream manifest(manifestFilename.c_str(), std::ios::in | std::ios::binary);
+        if (!manifest.is_open())
+            return;
+
+        std::string line;
+        while (std::getline(manifest, line))
+        {
+            if (line.compare(0, 7, "source ") == 0)
+            {
+                if (line.substr(7) == source)
+                    return;
+                break;
+            }
+        }
+
+        throw new xdvdfs::Exception("The store already has a manifest for another image with this name");
+    }
+
+    uint64_t imageSize (std::ifstream& file)
+    {
+        file.seekg(0, std::ios::end);
+        return static_cast<uint64_t>(file.tellg());
+    }
+}
+
+std::string store::manifestFilename (const std::string& storeDirectory, const std::string& imageFilename)
+{
+    return storeDirectory + "/" + imageFilename.substr(imageFilename.find_last_of("/\\") + 1) + ".manifest";
+}
+
+/**
+ * Stores the files of an image as blobs and writes its manifest. The image
+ * is read front to back once; only blobs missing from the store are written.
+*/
+void store::exportImage (const std::string& imageFilename, const std::string& storeDirectory, store::Summary& summary)
+{
+    std::ifstream image(imageFilename.c_str(), std::ios::in | std::ios::binary);
+    if (!image.is_open())
+        throw new xdvdfs::Exception("Could not open image");
+
+    image.exceptions(image.failbit | image.badbit | image.eofbit);
+
+    uint64_t size = imageSize(image);
+
+    std::string manifest = manifestFilename(storeDirectory, imageFilename);
+    std::string source = absolutePath(imageFilename);
+    checkManifestSource(manifest, source);
+
+    xdvdfs::VolumeDescriptor vd;
+    vd.readFromFile(image);
+    vd.validate();
+
+    std::vector<Segment> files;
+    xdvdfs::TreeWalker walker;
+    walker.walk(image, vd, [&] (const xdvdfs::EntryView& entry) {
+        Segment segment;
+        segment.zero = false;
+        segment.offset = static_cast<uint64_t>(entry.startSector) * xdvdfs::SECTOR_SIZE;
+        segment.size = entry.fileSize;
+
+        // empty files have no data, and files outside of the image are damaged
+        if (!entry.isDirectory() && segment.size > 0 && segment.offset + segment.size <= size)
+        {
+            segment.path = entry.path.str();
+            files.push_back(segment);
+        }
+        return true;
+    });
+
+    std::sort(files.begin(), files.end(), [] (const Segment& a, const Segment& b) {
+        return a.offset < b.offset;
+    });
+
+    mkdir(storeDirectory.c_str(), 0755);
+    mkdir((storeDirectory + "/blobs").c_str(), 0755);
+
+    std::string residualTemporary = temporaryFilename(storeDirectory);
+    std::ofstream residual(residualTemporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!residual.is_open())
+        throw new xdvdfs::Exception("Could not write to the store");
+
+    hash::Sha1 imageHash, residualHash;
+    std::vector<Segment> segments;
+    uint64_t position = 0;
+
+    for (std::size_t i=0; i<files.size(); ++i)
+    {
+        // files sharing their data with one before, or overlapping it, are covered already
+        if (files[i].offset < position)
+            continue;
+
+        storeGap(image, position, files[i].offset - position, segments, residual, residualHash, imageHash);
+        storeFile(image, files[i], storeDirectory, imageHash, summary);
+        segments.push_back(files[i]);
+        ++summary.files;
+
+        position = files[i].offset + files[i].size;
+    }
+
+    storeGap(image, position, size - position, segments, residual, residualHash, imageHash);
+
+    uint64_t residualSize = static_cast<uint64_t>(residual.tellp());
+    residual.close();
+    if (!residual)
+        throw new xdvdfs::Exception("Could not write to the store");
+
+    std::string residualSha1 = residualHash.hexdigest();
+    if (exists(blobFilename(storeDirectory, residualSha1)))
+    {
+        std::remove(residualTemporary.c_str());
+        summary.bytesShared += residualSize;
+    }
+    else
+    {
+        commitBlob(storeDirectory, residualTemporary, residualSha1);
+        ++summary.blobsWritten;
+        summary.bytesWritten += residualSize;
+    }
+
+    // the manifest is written under a temporary name too, so that it is never seen half written
+    std::string temporary = temporaryFilename(storeDirectory);
+    std::ofstream out(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    out << "xbiso-store 1\n"
+        << "source " << source << "\n"
+        << "image " << size << " " << imageHash.hexdigest() << "\n"
+        << "residual " << residualSize << " " << residualSha1 << "\n";
+
+    for (std::size_t i=0; i<segments.size(); ++i)
+    {
+        if (segments[i].zero)
+            out << "zero " << segments[i].offset << " " << segments[i].size << "\n";
+        else
+            out << "file " << segments[i].offset << " " << segments[i].size << " " << segments[i].sha1 << " " << segments[i].path << "\n";
+    }
+
+    out.close();
+    if (!out)
+    {
+        std::remove(temporary.c_str());
+        throw new xdvdfs::Exception("Could not write manifest");
+    }
+
+    if (!replaceFile(temporary, manifest))
+    {
+        std::remove(temporary.c_str());
+        throw new xdvdfs::Exception("Could not write manifest");
+    }
+}
+
+/**
+ * Rebuilds an image from its manifest and the blobs, writing it front to
+ * back, and checks the result against the image's SHA-1.
+*/
+void store::rebuildImage (const std::string& storeDirectory, const std::string& imageFilename)
+{
+    std::ifstream manifest(manifestFilename(storeDirectory, imageFilename).c_str(), std::ios::in | std::ios::binary);
+    if (!manifest.is_open())
+        throw new xdvdfs::Exception("Could not open manifest");
+
+    std::string line, keyword, imageSha1, residualSha1;
+    uint64_t size = 0, residualSize = 0;
+    std::vector<Segment> segments;
+
+    if (!std::getline(manifest, line) || line != "xbiso-store 1")
+        throw new xdvdfs::Exception("Not a store manifest");
+
+    while (std::getline(manifest, line))
+    {
+        std::istringstream stream(line);
+        stream >> keyword;
+
+        Segment segment;
+        bool valid;
+
+        if (keyword == "source") {
+            valid = true;
+        } else if (keyword == "image") {
+            valid = static_cast<bool>(stream >> size >> imageSha1);
+        } else if (keyword == "residual") {
+            valid = static_cast<bool>(stream >> residualSize >> residualSha1);
+        } else if (keyword == "zero") {
+            segment.zero = true;
+            valid = static_cast<bool>(stream >> segment.offset >> segment.size);
+            segments.push_back(segment);
+        } else if (keyword == "file") {
+            segment.zero = false;
+            valid = static_cast<bool>(stream >> segment.offset >> segment.size >> segment.sha1);
+            segments.push_back(segment);
+        } else {
+            valid = false;
+        }
+
+        if (!valid)
+            throw new xdvdfs::Exception("Invalid line in manifest");
+    }
+
+    // everything is checked before writing, so a damaged store fails fast
+    uint64_t end = 0, blobBytes;
+    for (std::size_t i=0; i<segments.size(); ++i)
+    {
+        if (segments[i].offset < end || segments[i].offset + segments[i].size > size)
+            throw new xdvdfs::Exception("Manifest entries are out of order");
+
+        end = segments[i].offset + segments[i].size;
+
+        if (!segments[i].zero && !blobSize(blobFilename(storeDirectory, segments[i].sha1), blobBytes))
+            throw new xdvdfs::Exception("Blob is missing");
+
+        if (!segments[i].zero && blobBytes != segments[i].size)
+            throw new xdvdfs::Exception("Blob has the wrong size");
+    }
+
+    if (!blobSize(blobFilename(storeDirectory, residualSha1), blobBytes))
+        throw new xdvdfs::Exception("Residual blob is missing");
+
+    if (blobBytes != residualSize)
+        throw new xdvdfs::Exception("Residual blob has the wrong size");
+
+    std::ifstream residual(blobFilename(storeDirectory, residualSha1).c_str(), std::ios::in | std::ios::binary);
+    residual.exceptions(residual.failbit | residual.badbit | residual.eofbit);
+
+    // an existing image is only replaced once the rebuilt one is complete and verified
+    std::string temporary = imageFilename + ".partial-" + std::to_string(getpid());
+    std::ofstream image(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!image.is_open())
+        throw new xdvdfs::Exception("Could not create image");
+
+    std::vector<char> buffer(CHUNK_SIZE);
+    hash::Sha1 imageHash;
+    uint64_t position = 0;
+
+    // copies from a stream, or zeros if there is none, to the image
+    auto write = [&] (std::ifstream* from, uint64_t length) {
+        if (!from)
+            std::fill(buffer.begin(), buffer.end(), 0);
+
+        for (uint64_t done = 0; done < length; )
+        {
+            std::size_t chunk = static_cast<std::size_t>(std::min<uint64_t>(buffer.size(), length - done));
+            if (from)
+                from->read(buffer.data(), chunk);
+
+            image.write(buffer.data(), chunk);
+            imageHash.update(buffer.data(), chunk);
+            done += chunk;
+        }
+
+        position += length;
+    };
+
+    try {
+        for (std::size_t i=0; i<segments.size(); ++i)
+        {
+            write(&residual, segments[i].offset - position);
+
+            if (segments[i].zero)
+            {
+                write(nullptr, segments[i].size);
+                continue;
+            }
+
+            std::ifstream blob(blobFilename(storeDirectory, segments[i].sha1).c_str(), std::ios::in | std::ios::binary);
+            if (!blob.is_open())
+                throw new xdvdfs::Exception("Blob is missing");
+
+            blob.exceptions(blob.failbit | blob.badbit | blob.eofbit);
+            write(&blob, segments[i].size);
+        }
+
+        write(&residual, size - position);
+
+        image.close();
+        if (!image)
+            throw new xdvdfs::Exception("Writing the image failed");
+
+        if (imageHash.hexdigest() != imageSha1)
+            throw new xdvdfs::Exception("The rebuilt image has the wrong checksum");
+
+        if (!replaceFile(temporary, imageFilename))
+            throw new xdvdfs::Exception("Could not replace the image");
+    } catch (...) {
+        if (image.is_open())
+            image.close();
+        std::remove(temporary.c_str());
+        throw;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace store
+{
+    struct Summary
+    {
+        uint64_t files;
+        uint64_t blobsWritten;
+        uint64_t bytesWritten;
+        uint64_t bytesShared;       ///< data of blobs that were already in the store
+    };
+
+    std::string manifestFilename (const std::string& storeDirectory, const std::string& imageFilename);
+
+    void exportImage (const std::string& imageFilename, const std::string& storeDirectory, Summary& summary);
+    void rebuildImage (const std::string& storeDirectory, const std::string& imageFilename);
+}
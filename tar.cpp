@@ -0,0 +1,122 @@
+#include "tar.hpp"
+
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+    void writeOctal (char* field, std::size_t length, uint64_t value)
+    {
+        // the field is zero-padded and terminated by a NUL byte
+        std::snprintf(field, length, "%0*llo", static_cast<int>(length-1), static_cast<unsigned long long>(value));
+    }
+
+    /**
+     * Splits a path into the ustar prefix and name fields. Returns false if the
+     * path can't be represented that way.
+    */
+    bool splitPath (const std::string& path, std::string& prefix, std::string& name)
+    {
+        if (path.size() <= 100)
+        {
+            prefix.clear();
+            name = path;
+            return true;
+        }
+
+        std::size_t pos = path.find('/', path.size() > 101 ? path.size()-101 : 0);
+
+        while (pos != std::string::npos)
+        {
+            if (pos <= 155 && path.size()-pos-1 <= 100 && pos > 0)
+            {
+                prefix = path.substr(0, pos);
+                name = path.substr(pos+1);
+                return true;
+            }
+
+            pos = path.find('/', pos+1);
+        }
+
+        return false;
+    }
+}
+
+void tar::Writer::writeHeader (const std::string& path, char type, uint64_t size, std::time_t mtime)
+{
+    std::string prefix, name;
+
+    if (!splitPath(path, prefix, name))
+    {
+        // the record length includes the length field itself
+        std::string record = " path=" + path + "\n";
+        std::size_t length = record.size() + 1;
+        while (std::to_string(length).size() + record.size() != length)
+            ++length;
+
+        std::string pax = std::to_string(length) + record;
+
+        this->writeHeader("././@PaxHeader", 'x', pax.size(), mtime);
+        this->stream.write(pax.data(), pax.size());
+        this->writePadding(pax.size());
+
+        prefix.clear();
+        name = path.substr(0, 100);
+    }
+
+    char header[BLOCK_SIZE];
+    std::memset(header, 0, sizeof(header));
+
+    std::memcpy(header, name.data(), name.size());
+    writeOctal(header+100, 8, type == '5' ? 0755 : 0644);
+    writeOctal(header+108, 8, 0);
+    writeOctal(header+116, 8, 0);
+    writeOctal(header+124, 12, size);
+    writeOctal(header+136, 12, static_cast<uint64_t>(mtime));
+    header[156] = type;
+    std::memcpy(header+257, "ustar", 6);
+    std::memcpy(header+263, "00", 2);
+    std::memcpy(header+345, prefix.data(), prefix.size());
+
+    // the checksum is calculated with the checksum field filled with spaces
+    std::memset(header+148, ' ', 8);
+    unsigned int checksum = 0;
+    for (std::size_t i=0; i<sizeof(header); ++i)
+        checksum += static_cast<unsigned char>(header[i]);
+    writeOctal(header+148, 7, checksum);
+
+    this->stream.write(header, sizeof(header));
+}
+
+void tar::Writer::writePadding (uint64_t size)
+{
+    static const char zeros[BLOCK_SIZE] = {0};
+    std::size_t remainder = size % BLOCK_SIZE;
+
+    if (remainder != 0)
+        this->stream.write(zeros, BLOCK_SIZE - remainder);
+}
+
+void tar::Writer::addDirectory (const std::string& path, std::time_t mtime)
+{
+    this->writeHeader(path + "/", '5', 0, mtime);
+}
+
+void tar::Writer::beginFile (const std::string& path, uint64_t size, std::time_t mtime)
+{
+    this->writeHeader(path, '0', size, mtime);
+    this->pending = size;
+}
+
+void tar::Writer::endFile ()
+{
+    this->writePadding(this->pending);
+    this->pending = 0;
+}
+
+void tar::Writer::finish ()
+{
+    static const char zeros[2*BLOCK_SIZE] = {0};
+    this->stream.write(zeros, sizeof(zeros));
+    this->stream.flush();
+}
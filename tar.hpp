@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <ostream>
+#include <string>
+
+namespace tar
+{
+    static const int BLOCK_SIZE = 512;
+
+    /**
+     * This class writes a POSIX (ustar) tar stream. Paths that don't fit into
+     * the ustar name/prefix fields are stored in a pax extended header.
+    */
+    class Writer
+    {
+        public:
+            explicit Writer (std::ostream& stream) : stream(stream), pending(0) {}
+
+            void addDirectory (const std::string& path, std::time_t mtime);
+            void beginFile (const std::string& path, uint64_t size, std::time_t mtime);
+            void endFile ();
+            void finish ();
+
+        private:
+            void writeHeader (const std::string& path, char type, uint64_t size, std::time_t mtime);
+            void writePadding (uint64_t size);
+
+            std::ostream& stream;
+            uint64_t pending;   ///< size of the file data written after beginFile
+    };
+}
@@ -0,0 +1,68 @@
+#include "throttle.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+void TokenBucket::setRate (uint64_t rate)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // up to a tenth of a second of unused rate may be saved up
+    this->rate = rate;
+    this->burst = rate / 10.0;
+    this->tokens = this->burst;
+    this->last = Clock::now();
+}
+
+void TokenBucket::acquire (uint64_t amount)
+{
+    if (this->rate == 0)
+        return;
+
+    double deficit;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - this->last).count();
+        this->last = now;
+
+        this->tokens += elapsed * this->rate;
+        if (this->tokens > this->burst)
+            this->tokens = this->burst;
+
+        this->tokens -= amount;
+        deficit = -this->tokens;
+    }
+
+    if (deficit > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(deficit / this->rate));
+}
+
+/**
+ * Parses a rate like "500", "64K", "20M" or "1G" (binary multiples). Returns 0
+ * for an invalid rate.
+*/
+uint64_t TokenBucket::parseRate (const std::string& str)
+{
+    char* end;
+    double value = std::strtod(str.c_str(), &end);
+
+    switch (*end)
+    {
+        case 'k': case 'K': value *= 1024.0; ++end; break;
+        case 'm': case 'M': value *= 1024.0*1024.0; ++end; break;
+        case 'g': case 'G': value *= 1024.0*1024.0*1024.0; ++end; break;
+        default: break;
+    }
+
+    if (*end != '\0' || end == str.c_str() || !std::isfinite(value) || value < 1)
+        return 0;
+
+    // 2^64, the first value that does not fit
+    if (value >= 18446744073709551616.0)
+        return 0;
+
+    return static_cast<uint64_t>(value);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * A token bucket limiting the rate of some resource (bytes, operations) to a
+ * number of units per second. It can be shared by several threads; a caller
+ * that exceeds the rate reserves its tokens anyway and sleeps until they
+ * would have been available, outside of the lock.
+*/
+class TokenBucket
+{
+    public:
+        TokenBucket () : rate(0), burst(0), tokens(0) {}
+
+        void setRate (uint64_t rate);
+        bool isLimited () const { return this->rate > 0; }
+        void acquire (uint64_t amount);
+
+        static uint64_t parseRate (const std::string& str);
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        uint64_t rate;          ///< units per second, 0 means unlimited
+        double burst;           ///< maximum number of tokens saved up
+        double tokens;
+        Clock::time_point last;
+        std::mutex mutex;
+};
@@ -0,0 +1,146 @@
+#include "trace.hpp"
+
+namespace {
+    struct ThreadBuffer
+    {
+        const void* tracer;
+        void* buffer;
+    };
+
+    thread_local ThreadBuffer current = {nullptr, nullptr};
+
+    std::string escape (const std::string& str)
+    {
+        std::string result;
+        result.reserve(str.size());
+
+        for (std::size_t i=0; i<str.size(); ++i)
+        {
+            unsigned char c = str[i];
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if (c < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                result += code;
+            } else {
+                result += c;
+            }
+        }
+
+        return result;
+    }
+}
+
+const std::size_t Tracer::FLUSH_EVENTS;
+
+Tracer::~Tracer ()
+{
+    this->close();
+
+    for (std::size_t i=0; i<this->buffers.size(); ++i)
+        delete this->buffers[i];
+}
+
+bool Tracer::open (const std::string& filename)
+{
+    this->file = std::fopen(filename.c_str(), "wb");
+    this->origin = Clock::now();
+
+    // starting with an event means every later one can be prefixed with a comma
+    if (this->file)
+        std::fputs("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"xbiso\"}}", this->file);
+
+    return this->file != nullptr;
+}
+
+void Tracer::complete (const char* category, const char* name, Clock::time_point start, const std::string& detail)
+{
+    Clock::time_point end = Clock::now();
+
+    Event event;
+    event.category = category;
+    event.name = name;
+    event.detail = detail;
+    event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - this->origin).count();
+    event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    Buffer& buffer = this->threadBuffer();
+    buffer.events.push_back(event);
+
+    if (buffer.events.size() >= FLUSH_EVENTS)
+        this->flush(buffer);
+}
+
+/**
+ * Returns the buffer of the calling thread, registering a new one on its
+ * first event.
+*/
+Tracer::Buffer& Tracer::threadBuffer ()
+{
+    if (current.tracer != this)
+    {
+        Buffer* buffer = new Buffer();
+        buffer->events.reserve(FLUSH_EVENTS);
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        buffer->thread = this->buffers.size() + 1;
+        this->buffers.push_back(buffer);
+
+        std::fprintf(this->file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                     buffer->thread, buffer->thread);
+
+        current.tracer = this;
+        current.buffer = buffer;
+    }
+
+    return *static_cast<Buffer*>(current.buffer);
+}
+
+/**
+ * Formats the events of a buffer without holding the lock, then appends
+ * them to the trace file and empties the buffer.
+*/
+void Tracer::flush (Tracer::Buffer& buffer)
+{
+    std::string text;
+    char line[256];
+
+    for (std::size_t i=0; i<buffer.events.size(); ++i)
+    {
+        const Event& event = buffer.events[i];
+
+        std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                      event.name, event.category, buffer.thread, event.start / 1000.0, event.duration / 1000.0);
+        text += line;
+
+        if (!event.detail.empty())
+            text += ",\"args\":{\"path\":\"" + escape(event.detail) + "\"}";
+
+        text += "}";
+    }
+
+    buffer.events.clear();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::fwrite(text.data(), 1, text.size(), this->file);
+}
+
+/**
+ * Writes the remaining events of all threads into the trace file. All threads
+ * that recorded events must have finished.
+*/
+void Tracer::close ()
+{
+    if (!this->file)
+        return;
+
+    for (std::size_t i=0; i<this->buffers.size(); ++i)
+        this->flush(*this->buffers[i]);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::fputs("\n],\"displayTimeUnit\":\"ms\"}\n", this->file);
+    std::fclose(this->file);
+    this->file = nullptr;
+}
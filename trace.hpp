@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * This class records spans of time in the Chrome trace event format, which
+ * can be loaded into chrome://tracing or Perfetto. Every thread appends to
+ * its own buffer without locking and only takes the lock to write the buffer
+ * to the trace file once it's full, so memory use doesn't grow with the
+ * length of the trace.
+*/
+class Tracer
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        Tracer () : file(nullptr) {}
+        ~Tracer ();
+
+        bool open (const std::string& filename);
+        bool isOpen () const { return this->file != nullptr; }
+        void complete (const char* category, const char* name, Clock::time_point start, const std::string& detail = "");
+        void close ();
+
+        static const std::size_t FLUSH_EVENTS = 4096;
+
+        /**
+         * Records a span from its construction until it goes out of scope.
+         * It does nothing if the tracer isn't open.
+        */
+        class Span
+        {
+            public:
+                Span (Tracer& tracer, const char* category, const char* name, const std::string& detail = "") :
+                    tracer(tracer), category(category), name(name)
+                {
+                    if (tracer.isOpen()) {
+                        this->detail = detail;
+                        this->start = Clock::now();
+                    }
+                }
+
+                ~Span ()
+                {
+                    if (this->tracer.isOpen())
+                        this->tracer.complete(this->category, this->name, this->start, this->detail);
+                }
+
+            private:
+                Tracer& tracer;
+                const char* category;
+                const char* name;
+                std::string detail;
+                Clock::time_point start;
+        };
+
+    private:
+        struct Event
+        {
+            const char* category;       ///< string literals only, so they needn't be copied
+            const char* name;
+            std::string detail;
+            int64_t start;              ///< nanoseconds since the trace was opened
+            int64_t duration;
+        };
+
+        struct Buffer
+        {
+            unsigned int thread;
+            std::vector<Event> events;
+        };
+
+        Buffer& threadBuffer ();
+        void flush (Buffer& buffer);
+
+        std::FILE* file;
+        Clock::time_point origin;
+        std::vector<Buffer*> buffers;
+        std::mutex mutex;           ///< guards the list of buffers and the trace file, not the buffers' contents
+};
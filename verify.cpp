@@ -0,0 +1,324 @@
+#include "verify.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+    const std::size_t CHUNK_SIZE = 8*1024*1024;
+
+    std::string lowerCase (std::string str)
+    {
+        for (std::size_t i=0; i<str.size(); ++i)
+            str[i] = std::tolower(static_cast<unsigned char>(str[i]));
+        return str;
+    }
+
+    bool isHex (const std::string& str, std::size_t length)
+    {
+        if (str.size() != length)
+            return false;
+
+        for (std::size_t i=0; i<str.size(); ++i)
+        {
+            if (!std::isxdigit(static_cast<unsigned char>(str[i])))
+                return false;
+        }
+
+        return true;
+    }
+
+    int64_t parseSize (const std::string& str)
+    {
+        char* end = nullptr;
+        errno = 0;
+        long long size = std::strtoll(str.c_str(), &end, 10);
+
+        if (str.empty() || *end != '\0' || errno == ERANGE || size < 0)
+            throw new xdvdfs::Exception("Invalid size in hash list");
+
+        return size;
+    }
+
+    /**
+     * Returns the value of an XML attribute inside a tag, with the basic
+     * entities decoded.
+    */
+    std::string attribute (const std::string& tag, const std::string& name)
+    {
+        std::size_t pos = 0;
+
+        while ((pos = tag.find(name + "=\"", pos)) != std::string::npos)
+        {
+            if (pos == 0 || std::isspace(static_cast<unsigned char>(tag[pos-1])))
+                break;
+            pos += name.size();
+        }
+
+        if (pos == std::string::npos)
+            return "";
+
+        pos += name.size() + 2;
+        std::size_t end = tag.find('"', pos);
+        std::string value = tag.substr(pos, end-pos);
+
+        static const char* entities[][2] = {{"&quot;", "\""}, {"&apos;", "'"}, {"&lt;", "<"}, {"&gt;", ">"}, {"&amp;", "&"}};
+        for (std::size_t i=0; i<sizeof(entities)/sizeof(entities[0]); ++i)
+        {
+            std::size_t p = 0;
+            while ((p = value.find(entities[i][0], p)) != std::string::npos)
+            {
+                value.replace(p, std::strlen(entities[i][0]), entities[i][1]);
+                p += 1;
+            }
+        }
+
+        return value;
+    }
+
+    void loadDat (const std::string& content, std::vector<verify::Expected>& entries)
+    {
+        std::size_t pos = 0;
+
+        while ((pos = content.find("<rom ", pos)) != std::string::npos)
+        {
+            std::size_t end = content.find('>', pos);
+            std::string tag = content.substr(pos, end-pos);
+            pos = end;
+
+            verify::Expected entry;
+            entry.name = attribute(tag, "name");
+            std::string size = attribute(tag, "size");
+            entry.size = size.empty() ? -1 : parseSize(size);
+            entry.crc32 = lowerCase(attribute(tag, "crc"));
+            entry.md5 = lowerCase(attribute(tag, "md5"));
+            entry.sha1 = lowerCase(attribute(tag, "sha1"));
+            entries.push_back(entry);
+        }
+    }
+
+    /**
+     * Reads xbiso manifests ("crc32 md5 sha1 size path") as well as the output
+     * of md5sum/sha1sum ("hash  name") and SFV files ("name crc32").
+    */
+    void loadList (const std::string& content, std::vector<verify::Expected>& entries)
+    {
+        std::istringstream stream(content);
+        std::string line;
+
+        while (std::getline(stream, line))
+        {
+            if (!line.empty() && line[line.size()-1] == '\r')
+                line.erase(line.size()-1);
+
+            if (line.empty() || line[0] == ';' || line[0] == '#')
+                continue;
+
+            std::istringstream fields(line);
+            std::string first;
+            fields >> first;
+
+            verify::Expected entry;
+            entry.size = -1;
+
+            std::string crc, md5, sha1, size;
+            if (isHex(first, 8) && (fields >> md5 >> sha1 >> size) && isHex(md5, 32) && isHex(sha1, 40))
+            {
+                entry.crc32 = lowerCase(first);
+                entry.md5 = lowerCase(md5);
+                entry.sha1 = lowerCase(sha1);
+                entry.size = parseSize(size);
+                fields.get();
+                std::getline(fields, entry.name);
+            }
+            else if (isHex(first, 32) || isHex(first, 40))
+            {
+                (first.size() == 32 ? entry.md5 : entry.sha1) = lowerCase(first);
+                std::size_t pos = line.find_first_of(" \t", first.size());
+                pos = line.find_first_not_of(" \t", pos);
+                if (pos != std::string::npos && line[pos] == '*')
+                    ++pos;
+                entry.name = pos == std::string::npos ? "" : line.substr(pos);
+            }
+            else
+            {
+                std::size_t pos = line.find_last_of(" \t");
+                if (pos == std::string::npos || !isHex(line.substr(pos+1), 8))
+                    throw new xdvdfs::Exception("Unrecognized line in hash list");
+
+                entry.crc32 = lowerCase(line.substr(pos+1));
+                entry.name = line.substr(0, line.find_last_not_of(" \t", pos)+1);
+            }
+
+            entries.push_back(entry);
+        }
+    }
+
+    struct FileState
+    {
+        uint64_t begin;     ///< offset of the file's data in the image
+        uint64_t end;
+        hash::FileHashes hashes;
+    };
+
+    /**
+     * Feeds the part of the chunk that overlaps with the given files into
+     * their hashes.
+    */
+    void hashFiles (const char* chunk, uint64_t offset, std::size_t length, std::vector<FileState*>& files)
+    {
+        for (std::size_t i=0; i<files.size(); ++i)
+        {
+            uint64_t begin = std::max(files[i]->begin, offset);
+            uint64_t end = std::min(files[i]->end, offset + length);
+
+            if (begin < end)
+                files[i]->hashes.update(chunk + (begin-offset), end-begin);
+        }
+    }
+}
+
+void verify::loadHashList (const std::string& filename, std::vector<verify::Expected>& entries)
+{
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        throw new xdvdfs::Exception("Could not open hash list");
+
+    std::ostringstream content;
+    content << file.rdbuf();
+
+    if (content.str().find("<rom ") != std::string::npos)
+        loadDat(content.str(), entries);
+    else
+        loadList(content.str(), entries);
+}
+
+/**
+ * Hashes the whole image and every file in a single sequential read. While a
+ * chunk is hashed, the next one is read: the image's MD5 and SHA-1 each run on
+ * their own thread, the CRC is computed in parallel slices that get combined
+ * afterwards, and the files overlapping the chunk are spread across threads.
+*/
+void verify::hashImage (std::ifstream& file, verify::Result& image, std::vector<xdvdfs::TreeEntry>& files, std::vector<verify::Result>& fileResults)
+{
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    file.seekg(0, file.end);
+    uint64_t imageSize = file.tellg();
+    file.seekg(0, file.beg);
+
+    std::vector<FileState> states(files.size());
+    std::vector<FileState*> order;
+    for (std::size_t i=0; i<files.size(); ++i)
+    {
+        states[i].begin = static_cast<uint64_t>(files[i].dirent.getStartSector()) * xdvdfs::SECTOR_SIZE;
+        states[i].end = states[i].begin + files[i].dirent.getFileSize();
+        if (states[i].end > states[i].begin)
+            order.push_back(&states[i]);
+    }
+
+    std::sort(order.begin(), order.end(), [] (FileState* a, FileState* b) { return a->begin < b->begin; });
+
+    hash::Md5 md5;
+    hash::Sha1 sha1;
+    uint32_t crc = 0;
+
+    std::vector<char> buffers[2] = {std::vector<char>(CHUNK_SIZE), std::vector<char>(CHUNK_SIZE)};
+    std::size_t nextFile = 0;
+    std::vector<FileState*> active;
+
+    uint64_t offset = 0;
+    std::size_t length = std::min<uint64_t>(CHUNK_SIZE, imageSize);
+    file.read(buffers[0].data(), length);
+
+    for (int current=0; length > 0; current ^= 1)
+    {
+        const char* chunk = buffers[current].data();
+        std::vector<std::future<void> > tasks;
+
+        tasks.push_back(std::async(std::launch::async, [&md5, chunk, length] { md5.update(chunk, length); }));
+        tasks.push_back(std::async(std::launch::async, [&sha1, chunk, length] { sha1.update(chunk, length); }));
+
+        std::size_t sliceSize = (length + threads - 1) / threads;
+        std::vector<uint32_t> sliceCrcs(threads, 0);
+        for (unsigned int t=0; t<threads && t*sliceSize < length; ++t)
+        {
+            tasks.push_back(std::async(std::launch::async, [&sliceCrcs, chunk, length, sliceSize, t] {
+                hash::Crc32 c;
+                c.update(chunk + t*sliceSize, std::min(sliceSize, length - t*sliceSize));
+                sliceCrcs[t] = c.value();
+            }));
+        }
+
+        // update the set of files that overlap with this chunk
+        active.erase(std::remove_if(active.begin(), active.end(), [offset] (FileState* f) { return f->end <= offset; }), active.end());
+        while (nextFile < order.size() && order[nextFile]->begin < offset + length)
+            active.push_back(order[nextFile++]);
+
+        std::vector<std::vector<FileState*> > groups(threads);
+        for (std::size_t i=0; i<active.size(); ++i)
+            groups[i % threads].push_back(active[i]);
+
+        for (unsigned int t=0; t<threads && !groups[t].empty(); ++t)
+        {
+            std::vector<FileState*>* group = &groups[t];
+            tasks.push_back(std::async(std::launch::async, [chunk, offset, length, group] { hashFiles(chunk, offset, length, *group); }));
+        }
+
+        // read ahead while the hashes are computed
+        uint64_t nextOffset = offset + length;
+        std::size_t nextLength = std::min<uint64_t>(CHUNK_SIZE, imageSize - nextOffset);
+        if (nextLength > 0)
+            file.read(buffers[current^1].data(), nextLength);
+
+        for (std::size_t i=0; i<tasks.size(); ++i)
+            tasks[i].get();
+
+        for (unsigned int t=0; t<threads && t*sliceSize < length; ++t)
+            crc = hash::Crc32::combine(crc, sliceCrcs[t], std::min(sliceSize, length - t*sliceSize));
+
+        offset = nextOffset;
+        length = nextLength;
+    }
+
+    image.size = imageSize;
+    image.crc32 = hash::Crc32::hexdigest(crc);
+    image.md5 = md5.hexdigest();
+    image.sha1 = sha1.hexdigest();
+
+    fileResults.resize(files.size());
+    for (std::size_t i=0; i<files.size(); ++i)
+    {
+        fileResults[i].size = files[i].dirent.getFileSize();
+        fileResults[i].crc32 = states[i].hashes.crc32.hexdigest();
+        fileResults[i].md5 = states[i].hashes.md5.hexdigest();
+        fileResults[i].sha1 = states[i].hashes.sha1.hexdigest();
+    }
+}
+
+/**
+ * Returns true if every size and hash known to the hash list matches.
+*/
+bool verify::matches (const verify::Expected& expected, const verify::Result& result)
+{
+    if (expected.size >= 0 && static_cast<uint64_t>(expected.size) != result.size)
+        return false;
+
+    if (!expected.crc32.empty() && expected.crc32 != result.crc32)
+        return false;
+
+    if (!expected.md5.empty() && expected.md5 != result.md5)
+        return false;
+
+    if (!expected.sha1.empty() && expected.sha1 != result.sha1)
+        return false;
+
+    return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "xdvdfs.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace verify
+{
+    /**
+     * An entry of a hash list. Hashes that aren't known are empty, an
+     * unknown size is -1.
+    */
+    struct Expected
+    {
+        std::string name;
+        int64_t size;
+        std::string crc32;
+        std::string md5;
+        std::string sha1;
+    };
+
+    struct Result
+    {
+        uint64_t size;
+        std::string crc32;
+        std::string md5;
+        std::string sha1;
+    };
+
+    void loadHashList (const std::string& filename, std::vector<Expected>& entries);
+    void hashImage (std::ifstream& file, Result& image, std::vector<xdvdfs::TreeEntry>& files, std::vector<Result>& fileResults);
+    bool matches (const Expected& expected, const Result& result);
+}
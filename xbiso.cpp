@@ -16,23 +16,73 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.*/
 
 #include "xdvdfs.hpp"
+#include "pathindex.hpp"
+#include "diff.hpp"
+#include "patch.hpp"
+#include "store.hpp"
+#include "tar.hpp"
+#include "hash.hpp"
+#include "verify.hpp"
+#include "journal.hpp"
+#include "dedup.hpp"
+#include "scheduler.hpp"
+#include "throttle.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "progress.hpp"
+#include "logger.hpp"
 #include <string>
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
 #include "optionparser.h"
 #include <xbisoConfig.h>
 
 #if defined _WIN32
     #include "direct.h"
+    #include <io.h>
+    #include <fcntl.h>
+    #define NOMINMAX
+    #include <windows.h>
     #define mkdir(a,b) _mkdir(a)
-    #define chdir(a) _chdir(a)
 #else
     #include <unistd.h>
+    #include <fcntl.h>
     #include <sys/stat.h>
+    #include <sys/statvfs.h>
 #endif
 
-void handleDirectoryEntry (std::ifstream& file, xdvdfs::DirectoryEntry& dirent);
+/**
+ * The state of the extraction of a single image.
+*/
+struct Extraction
+{
+    std::ifstream file;
+    Deduplicator deduplicator;
+    Statistics stats;
+};
+
+int extractImage (const std::string& filename, const std::string& dirname, bool checkSpace, bool printStats);
+void handleDirectoryEntry (Extraction& extraction, xdvdfs::DirectoryEntry& dirent, const std::string& path);
+void extractFileEntry (Extraction& extraction, xdvdfs::DirectoryEntry& dirent, const std::string& path);
+void copyData (Extraction& extraction, xdvdfs::DirectoryEntry& dirent, const std::string* filename, hash::FileHashes* hashes);
+void writeManifestEntry (const verify::Result& result, const std::string& filename);
+bool isZero (const char* data, std::size_t length);
+uint64_t requiredSpace (std::vector<xdvdfs::TreeEntry>& entries, const std::string& prefix);
+bool availableSpace (const std::string& directory, uint64_t& bytes);
+bool isUpToDate (std::ifstream& file, xdvdfs::DirectoryEntry& dirent, const std::string& filename, bool sample);
+bool readHashList (const std::string& filename, std::vector<verify::Expected>& entries);
+void writeTar (std::ifstream& file, xdvdfs::VolumeDescriptor& vd, const std::string& prefix, tar::Writer& writer);
+int verifyImage (std::ifstream& file, xdvdfs::VolumeDescriptor& vd, const std::string& filename, const std::string& prefix,
+                 const std::vector<verify::Expected>& expected, bool checkList, bool checkFiles);
 
 struct Arg: public option::Arg {
     static option::ArgStatus NonEmpty (const option::Option& option, bool msg) {
@@ -44,9 +94,34 @@ struct Arg: public option::Arg {
 
         return option::ARG_ILLEGAL;
     }
+
+    static option::ArgStatus Positive (const option::Option& option, bool msg) {
+        char* end = nullptr;
+        unsigned long value = 0;
+        if (option.arg && std::isdigit(static_cast<unsigned char>(option.arg[0])))
+            value = std::strtoul(option.arg, &end, 10);
+
+        if (value > 0 && value <= UINT_MAX && *end == '\0')
+            return option::ARG_OK;
+
+        if (msg)
+            std::cerr << "Option '" << option.name << "' requires a positive number" << std::endl;
+
+        return option::ARG_ILLEGAL;
+    }
+
+    static option::ArgStatus Rate (const option::Option& option, bool msg) {
+        if (option.arg && TokenBucket::parseRate(option.arg) > 0)
+            return option::ARG_OK;
+
+        if (msg)
+            std::cerr << "Option '" << option.name << "' requires a rate like 500K or 20M" << std::endl;
+
+        return option::ARG_ILLEGAL;
+    }
 };
 
-enum optionIndex {UNKNOWN, HELP, VERBOSE, EXTRACT, DRYRUN, PROGRESS, DIRECTORY};
+enum optionIndex {UNKNOWN, HELP, VERBOSE, EXTRACT, DRYRUN, PROGRESS, DIRECTORY, TAR, MANIFEST, VERIFY, VERIFYFILES, INCREMENTAL, JOURNAL, RESUME, DEDUP, DEDUPCONTENT, SPARSE, NOSPACECHECK, JOBS, DEVICEJOBS, READLIMIT, WRITELIMIT, IOPSLIMIT, STATS, TRACE, QUIET, BUILDINDEX, DIFF, DIFFCONTENT, MAKEPATCH, APPLYPATCH, EXPORTSTORE, REBUILDSTORE};
 const option::Descriptor usage[] = {
     {UNKNOWN, 0, "", "", option::Arg::None, ""},
     {HELP, 0, "h", "help", option::Arg::None, ""},
@@ -55,11 +130,55 @@ const option::Descriptor usage[] = {
     {DRYRUN, 0, "n", "dry-run", option::Arg::None, ""},
     {PROGRESS, 0, "p", "progress", option::Arg::None, ""},
     {DIRECTORY, 0, "d", "directory", Arg::NonEmpty, ""},
+    {TAR, 0, "t", "tar", option::Arg::None, ""},
+    {MANIFEST, 0, "", "manifest", Arg::NonEmpty, ""},
+    {VERIFY, 0, "", "verify", option::Arg::Optional, ""},
+    {VERIFYFILES, 0, "", "verify-files", option::Arg::None, ""},
+    {INCREMENTAL, 0, "i", "incremental", option::Arg::Optional, ""},
+    {JOURNAL, 0, "", "journal", Arg::NonEmpty, ""},
+    {RESUME, 0, "", "resume", option::Arg::None, ""},
+    {DEDUP, 0, "", "dedup", option::Arg::Optional, ""},
+    {DEDUPCONTENT, 0, "", "dedup-content", option::Arg::None, ""},
+    {SPARSE, 0, "S", "sparse", option::Arg::None, ""},
+    {NOSPACECHECK, 0, "", "no-space-check", option::Arg::None, ""},
+    {JOBS, 0, "j", "jobs", Arg::Positive, ""},
+    {DEVICEJOBS, 0, "", "device-jobs", Arg::Positive, ""},
+    {READLIMIT, 0, "", "read-limit", Arg::Rate, ""},
+    {WRITELIMIT, 0, "", "write-limit", Arg::Rate, ""},
+    {IOPSLIMIT, 0, "", "iops-limit", Arg::Rate, ""},
+    {STATS, 0, "", "stats", option::Arg::None, ""},
+    {TRACE, 0, "", "trace", Arg::NonEmpty, ""},
+    {QUIET, 0, "q", "quiet", option::Arg::None, ""},
+    {BUILDINDEX, 0, "", "build-index", option::Arg::None, ""},
+    {DIFF, 0, "", "diff", option::Arg::None, ""},
+    {DIFFCONTENT, 0, "", "diff-content", option::Arg::None, ""},
+    {MAKEPATCH, 0, "", "make-patch", Arg::NonEmpty, ""},
+    {APPLYPATCH, 0, "", "apply-patch", Arg::NonEmpty, ""},
+    {EXPORTSTORE, 0, "", "export-store", Arg::NonEmpty, ""},
+    {REBUILDSTORE, 0, "", "rebuild-store", Arg::NonEmpty, ""},
     {0,0,0,0,0,0}
 };
 
 int verbosityLevel = 0;
 bool dryRun = false;
+bool sparseOutput = false;
+std::ofstream manifest;
+std::mutex manifestMutex;
+
+enum IncrementalMode {INCREMENTAL_OFF, INCREMENTAL_SIZE, INCREMENTAL_SAMPLE};
+IncrementalMode incrementalMode = INCREMENTAL_OFF;
+std::map<std::string, verify::Expected> previousManifest;
+Journal journal;
+Deduplicator::Method dedupMethod = Deduplicator::OFF;
+bool dedupContent = false;
+
+// shared by all workers, so the limits apply to the whole process
+TokenBucket readLimit;
+TokenBucket writeLimit;
+TokenBucket iopsLimit;
+Tracer tracer;
+Logger logger;
+Progress progress(logger);      // after the logger, as it reports through it until destroyed
 
 void printUsage ()
 {
@@ -82,11 +201,56 @@ void printUsage ()
               << "Options:\n"
               << "  -h,--help              Print this help message\n"
               << "  -v,--verbose           Be verbose\n"
+              << "  -q,--quiet             Only print errors\n"
               << "  -x,--extract           Extract the passed image files\n"
+              << "  -t,--tar               Write the contents of the passed image files\n"
+              << "                         as a tar stream to stdout\n"
+              << "  --build-index          Write a path index for fast lookups next to\n"
+              << "                         the passed image files (<image>.xbidx,\n"
+              << "                         e.g. image.iso.xbidx)\n"
+              << "  --diff                 Compare two images and list the files that\n"
+              << "                         were added, removed or modified\n"
+              << "  --diff-content         Also compare the contents of files that have\n"
+              << "                         the same size and position in both images\n"
+              << "  --make-patch <patch>   Write a patch turning the first image into\n"
+              << "                         the second one\n"
+              << "  --apply-patch <patch>  Apply a patch to the first image, writing the\n"
+              << "                         result to the second one\n"
+              << "  --export-store <dir>   Store the files of the passed images in <dir>,\n"
+              << "                         keeping every distinct file only once\n"
+              << "  --rebuild-store <dir>  Rebuild the passed images from <dir>\n"
               << "  -n,--dry-run           Dry-run only, don't actually modify files\n"
-              << "  -p,--progress          Show progress while extracting/creating\n"
+              << "  -p,--progress          Show progress while extracting\n"
               << "  -d,--directory <dir>   Extract into directory <dir>.\n"
               << "                         Only valid when passing a single file.\n"
+              << "  --manifest <file>      Hash the files while extracting and write\n"
+              << "                         \"crc32 md5 sha1 size path\" lines to <file>\n"
+              << "  --verify[=<list>]      Hash the passed image files and check them\n"
+              << "                         against a DAT file or hash list, if given\n"
+              << "  --verify-files         Also hash and check every file in the image\n"
+              << "  -i,--incremental[=sample]\n"
+              << "                         Skip existing files that have the right size.\n"
+              << "                         With 'sample', some blocks are compared, too.\n"
+              << "                         With --manifest, files are compared to the\n"
+              << "                         hashes in the previous manifest.\n"
+              << "  --journal <file>       Record completed files in <file>\n"
+              << "  --resume               Skip the files recorded in the journal\n"
+              << "  --dedup[=reflink]      Hardlink (or reflink) files that share their\n"
+              << "                         data with a file extracted before\n"
+              << "  --dedup-content        Also deduplicate files with identical contents\n"
+              << "  -S,--sparse            Leave holes for zero-filled blocks\n"
+              << "  --no-space-check       Don't check for enough free space up front\n"
+              << "  -j,--jobs <n>          Extract up to <n> images at the same time\n"
+              << "  --device-jobs <n>      Extract up to <n> images from the same device\n"
+              << "                         at the same time (default: 1)\n"
+              << "  --read-limit <rate>    Limit reading from images to <rate> bytes/s\n"
+              << "  --write-limit <rate>   Limit writing files to <rate> bytes/s\n"
+              << "                         Rates take K, M and G suffixes.\n"
+              << "  --iops-limit <n>       Limit file reads and writes to <n> per second\n"
+              << "  --stats                Report time spent per phase and I/O statistics\n"
+              << "                         after every image\n"
+              << "  --trace <file>         Record a trace of the extraction for chrome://tracing\n"
+              << "                         or Perfetto\n"
               << std::endl;
 }
 
@@ -115,13 +279,144 @@ int main (int argc, char* argv[])
     if (options[DRYRUN])
         dryRun = true;
 
-    if (options[EXTRACT]) {
+    if (options[SPARSE])
+        sparseOutput = true;
+
+    verbosityLevel = options[VERBOSE].count();
+
+    if (options[QUIET])
+        logger.setLevel(Logger::LEVEL_ERROR);
+    else if (verbosityLevel > 0)
+        logger.setLevel(Logger::LEVEL_VERBOSE);
+
+    // the tar archive is written to stdout, so messages have to go elsewhere
+    logger.start(options[TAR] ? stderr : stdout);
+
+    if (options[INCREMENTAL]) {
+        std::string mode = options[INCREMENTAL].arg ? options[INCREMENTAL].arg : "";
+        if (mode.empty() || mode == "size") {
+            incrementalMode = INCREMENTAL_SIZE;
+        } else if (mode == "sample") {
+            incrementalMode = INCREMENTAL_SAMPLE;
+        } else {
+            std::cerr << "ERROR: Unknown incremental mode '" << mode << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if (options[DEDUP] || options[DEDUPCONTENT]) {
+        std::string method = options[DEDUP].arg ? options[DEDUP].arg : "";
+        dedupContent = options[DEDUPCONTENT];
+        if (method.empty() || method == "hardlink") {
+            dedupMethod = Deduplicator::HARDLINK;
+        } else if (method == "reflink") {
+            dedupMethod = Deduplicator::REFLINK;
+        } else {
+            std::cerr << "ERROR: Unknown deduplication method '" << method << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    const int limitOptions[] = {READLIMIT, WRITELIMIT, IOPSLIMIT};
+    TokenBucket* limits[] = {&readLimit, &writeLimit, &iopsLimit};
+    for (int i=0; i<3; ++i) {
+        if (!options[limitOptions[i]])
+            continue;
+
+        // the rates have been validated by the option parser
+        limits[i]->setRate(TokenBucket::parseRate(options[limitOptions[i]].arg));
+    }
+
+    if (options[RESUME] && !options[JOURNAL]) {
+        std::cerr << "ERROR: Resuming requires a journal file." << std::endl;
+        return 1;
+    }
+
+    if (options[JOURNAL] && !dryRun) {
+        try {
+            journal.open(options[JOURNAL].arg, options[RESUME]);
+        } catch (xdvdfs::Exception* e) {
+            logger.write(Logger::LEVEL_ERROR, std::string("ERROR: Opening journal '") + options[JOURNAL].arg + "' failed: " + e->what());
+            delete e;
+            return 1;
+        }
+    }
+
+    if (options[TRACE] && !tracer.open(options[TRACE].arg)) {
+        std::cerr << "ERROR: Could not open trace file '" << options[TRACE].arg << "'" << std::endl;
+        return 1;
+    }
+
+    if (options[MANIFEST]) {
+        // the previous manifest has to be read before it gets overwritten
+        std::ifstream previous(options[MANIFEST].arg);
+        if (incrementalMode != INCREMENTAL_OFF && previous.is_open()) {
+            previous.close();
+
+            std::vector<verify::Expected> entries;
+            if (!readHashList(options[MANIFEST].arg, entries))
+                return 1;
+
+            for (std::size_t i=0; i<entries.size(); ++i)
+                previousManifest[entries[i].name] = entries[i];
+        }
+
+        manifest.open(options[MANIFEST].arg, manifest.out | manifest.binary | manifest.trunc);
+        if (!manifest.is_open()) {
+            std::cerr << "ERROR: Could not open manifest file '" << options[MANIFEST].arg << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if (options[VERIFY]) {
+        std::vector<verify::Expected> expected;
+        bool checkList = options[VERIFY].arg != nullptr;
+        int failures = 0;
+
+        if (checkList && !readHashList(options[VERIFY].arg, expected))
+            return 1;
 
         for (int i=0; i<parse.nonOptionsCount(); ++i) {
             std::string filename = parse.nonOption(i);
-            std::string dirname = options[DIRECTORY] ? options[DIRECTORY].arg : filename.substr(0, filename.find_last_of("."));
+            std::string dirname = filename.substr(0, filename.find_last_of("."));
+            dirname = dirname.substr(dirname.find_last_of("/\\") + 1);
+
+            std::ifstream isofile;
+            isofile.open(filename.c_str(), isofile.binary | isofile.in);
+            if (!isofile.is_open()) {
+                std::cerr << "ERROR: Could not open file '" << filename << "'" << std::endl;
+                return 1;
+            }
+
+            isofile.exceptions(isofile.failbit | isofile.badbit | isofile.eofbit);
+
+            try {
+                xdvdfs::VolumeDescriptor vd;
+                vd.readFromFile(isofile);
+                vd.validate();
+
+                failures += verifyImage(isofile, vd, filename, dirname, expected, checkList, options[VERIFYFILES]);
+            } catch (xdvdfs::Exception* e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Verifying '" + filename + "' failed: " + e->what());
+                delete e;
+                ++failures;
+            } catch (std::exception& e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Verifying '" + filename + "' failed: " + e.what());
+                ++failures;
+            }
+        }
 
-            std::cout << "extracting " << filename << " to " << dirname << std::endl;
+        return failures > 0 ? 1 : 0;
+    } else if (options[TAR]) {
+#if defined _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        tar::Writer writer(std::cout);
+
+        for (int i=0; i<parse.nonOptionsCount(); ++i) {
+            std::string filename = parse.nonOption(i);
+            std::string dirname = options[DIRECTORY] ? options[DIRECTORY].arg : filename.substr(0, filename.find_last_of("."));
+            dirname = dirname.substr(dirname.find_last_of("/\\") + 1);
 
             std::ifstream isofile;
             isofile.open(filename.c_str(), isofile.binary | isofile.in);
@@ -132,21 +427,171 @@ int main (int argc, char* argv[])
 
             isofile.exceptions(isofile.failbit | isofile.badbit | isofile.eofbit);
 
-            xdvdfs::VolumeDescriptor vd;
-            vd.readFromFile(isofile);
-            vd.validate();
+            try {
+                xdvdfs::VolumeDescriptor vd;
+                vd.readFromFile(isofile);
+                vd.validate();
 
-            if (!dryRun) {
-                mkdir(dirname.c_str(), 0755);
-                chdir(dirname.c_str());
+                writeTar(isofile, vd, dirname, writer);
+            } catch (xdvdfs::Exception* e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Archiving '" + filename + "' failed: " + e->what());
+                delete e;
+                return 1;
+            } catch (std::exception& e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Archiving '" + filename + "' failed: " + e.what());
+                return 1;
             }
+        }
 
-            xdvdfs::DirectoryEntry de = vd.getRootDirEntry(isofile);
-            handleDirectoryEntry(isofile, de);
+        writer.finish();
+    } else if (options[DIFF]) {
+        if (parse.nonOptionsCount() != 2) {
+            logger.write(Logger::LEVEL_ERROR, "ERROR: Comparing requires exactly two image files.");
+            return 2;
+        }
 
-            if (!dryRun)
-                chdir("..");
+        std::ifstream isofiles[2];
+        xdvdfs::VolumeDescriptor vds[2];
+        bool changed = false;
+
+        try {
+            for (int i=0; i<2; ++i) {
+                isofiles[i].open(parse.nonOption(i), isofiles[i].binary | isofiles[i].in);
+                if (!isofiles[i].is_open()) {
+                    logger.write(Logger::LEVEL_ERROR, std::string("ERROR: Could not open file '") + parse.nonOption(i) + "'");
+                    return 2;
+                }
+
+                isofiles[i].exceptions(isofiles[i].failbit | isofiles[i].badbit | isofiles[i].eofbit);
+                vds[i].readFromFile(isofiles[i]);
+                vds[i].validate();
+            }
+
+            static const char* const names[] = {"ADDED", "REMOVED", "MODIFIED"};
+            diff::compareImages(isofiles[0], vds[0], isofiles[1], vds[1], options[DIFFCONTENT] ? diff::CONTENT_ALL : diff::CONTENT_MOVED,
+                                [&changed] (diff::Change change, const std::string& path) {
+                std::cout << names[change] << " " << path << "\n";
+                changed = true;
+            });
+        } catch (xdvdfs::Exception* e) {
+            logger.write(Logger::LEVEL_ERROR, std::string("ERROR: Comparing failed: ") + e->what());
+            delete e;
+            return 2;
+        } catch (std::exception& e) {
+            logger.write(Logger::LEVEL_ERROR, std::string("ERROR: Comparing failed: ") + e.what());
+            return 2;
+        }
+
+        std::cout.flush();
+        return changed ? 1 : 0;
+    } else if (options[MAKEPATCH] || options[APPLYPATCH]) {
+        if (parse.nonOptionsCount() != 2) {
+            logger.write(Logger::LEVEL_ERROR, "ERROR: Patching requires exactly two image files, the old and the new one.");
+            return 1;
+        }
+
+        try {
+            if (options[MAKEPATCH]) {
+                patch::Summary summary;
+                patch::create(parse.nonOption(0), parse.nonOption(1), options[MAKEPATCH].arg, summary);
+                logger.write(Logger::LEVEL_INFO, "patch has " + std::to_string(summary.patchSize) + " bytes: "
+                             + std::to_string(summary.copied) + " bytes copied, " + std::to_string(summary.zeros) + " zero bytes, "
+                             + std::to_string(summary.literal) + " bytes stored");
+            } else {
+                patch::apply(options[APPLYPATCH].arg, parse.nonOption(0), parse.nonOption(1));
+            }
+        } catch (xdvdfs::Exception* e) {
+            logger.write(Logger::LEVEL_ERROR, std::string("ERROR: Patching failed: ") + e->what());
+            delete e;
+            return 1;
+        } catch (std::exception& e) {
+            logger.write(Logger::LEVEL_ERROR, std::string("ERROR: Patching failed: ") + e.what());
+            return 1;
+        }
+
+        return 0;
+    } else if (options[EXPORTSTORE] || options[REBUILDSTORE]) {
+        int failures = 0;
+
+        for (int i=0; i<parse.nonOptionsCount(); ++i) {
+            std::string filename = parse.nonOption(i);
+
+            try {
+                if (options[EXPORTSTORE]) {
+                    store::Summary summary = {0, 0, 0, 0};
+                    store::exportImage(filename, options[EXPORTSTORE].arg, summary);
+                    logger.write(Logger::LEVEL_INFO, "stored " + filename + ": " + std::to_string(summary.files) + " files, "
+                                 + std::to_string(summary.blobsWritten) + " new blobs with " + std::to_string(summary.bytesWritten) + " bytes, "
+                                 + std::to_string(summary.bytesShared) + " bytes already stored");
+                } else {
+                    store::rebuildImage(options[REBUILDSTORE].arg, filename);
+                    logger.write(Logger::LEVEL_INFO, "rebuilt " + filename);
+                }
+            } catch (xdvdfs::Exception* e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Processing '" + filename + "' failed: " + e->what());
+                delete e;
+                ++failures;
+            } catch (std::exception& e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Processing '" + filename + "' failed: " + e.what());
+                ++failures;
+            }
+        }
+
+        return failures > 0 ? 1 : 0;
+    } else if (options[BUILDINDEX]) {
+        unsigned int threads = options[JOBS] ? std::strtoul(options[JOBS].arg, nullptr, 10) : std::thread::hardware_concurrency();
+        int failures = 0;
+
+        for (int i=0; i<parse.nonOptionsCount(); ++i) {
+            std::string filename = parse.nonOption(i);
+
+            try {
+                xdvdfs::PathIndex index;
+                index.build(filename, threads);
+                index.save(xdvdfs::PathIndex::sidecarFilename(filename));
+                logger.write(Logger::LEVEL_INFO, "indexed " + std::to_string(index.size()) + " entries of " + filename);
+            } catch (xdvdfs::Exception* e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Indexing '" + filename + "' failed: " + e->what());
+                delete e;
+                ++failures;
+            } catch (std::exception& e) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Indexing '" + filename + "' failed: " + e.what());
+                ++failures;
+            }
         }
+
+        return failures > 0 ? 1 : 0;
+    } else if (options[EXTRACT]) {
+        unsigned int jobs = options[JOBS] ? std::strtoul(options[JOBS].arg, nullptr, 10) : 1;
+        unsigned int deviceJobs = options[DEVICEJOBS] ? std::strtoul(options[DEVICEJOBS].arg, nullptr, 10) : 1;
+        bool checkSpace = !options[NOSPACECHECK];
+        bool printStats = options[STATS];
+        int failures = 0;
+        std::mutex failuresMutex;
+
+        Scheduler scheduler(jobs, deviceJobs);
+
+        if (options[PROGRESS])
+            progress.start(std::chrono::milliseconds(500));
+
+        for (int i=0; i<parse.nonOptionsCount(); ++i) {
+            std::string filename = parse.nonOption(i);
+            std::string dirname = options[DIRECTORY] ? options[DIRECTORY].arg : filename.substr(0, filename.find_last_of("."));
+
+            scheduler.addJob(filename, dirname, [=, &failures, &failuresMutex] {
+                if (extractImage(filename, dirname, checkSpace, printStats) != 0) {
+                    std::lock_guard<std::mutex> lock(failuresMutex);
+                    ++failures;
+                }
+            });
+        }
+
+        scheduler.run();
+        progress.stop();
+        tracer.close();
+
+        if (failures > 0)
+            return 1;
     } else {
         printUsage();
     }
@@ -154,49 +599,626 @@ int main (int argc, char* argv[])
     return 0;
 }
 
-void handleDirectoryEntry (std::ifstream& file, xdvdfs::DirectoryEntry& dirent)
+/**
+ * Extracts an image into the directory. Returns non-zero on failure.
+*/
+int extractImage (const std::string& filename, const std::string& dirname, bool checkSpace, bool printStats)
 {
+    logger.write(Logger::LEVEL_INFO, "extracting " + filename + " to " + dirname);
+
+    Tracer::Span span(tracer, "extract", "image", filename);
+
+    Extraction extraction;
+    std::ifstream& isofile = extraction.file;
+    isofile.open(filename.c_str(), isofile.binary | isofile.in);
+    if (!isofile.is_open()) {
+        logger.write(Logger::LEVEL_ERROR, "ERROR: Could not open file '" + filename + "'");
+        return 1;
+    }
+
+    isofile.exceptions(isofile.failbit | isofile.badbit | isofile.eofbit);
+
+    Statistics& stats = extraction.stats;
+
+    try {
+        xdvdfs::VolumeDescriptor vd;
+        xdvdfs::DirectoryEntry de;
+        std::vector<xdvdfs::TreeEntry> entries;
+
+        {
+            Statistics::Timer timer(stats, Statistics::VOLUME_DESCRIPTOR);
+            Tracer::Span span(tracer, "extract", "volume descriptor");
+            vd.readFromFile(isofile);
+            vd.validate();
+            de = vd.getRootDirEntry(isofile);
+        }
+
+        if (!dryRun) {
+            Statistics::Timer timer(stats, Statistics::DIRECTORIES);
+            mkdir(dirname.c_str(), 0755);
+        }
+
+        {
+            Statistics::Timer timer(stats, Statistics::TRAVERSAL);
+            Tracer::Span span(tracer, "extract", "traversal");
+            xdvdfs::listTree(isofile, de, entries);
+        }
+
+        // the listing is needed anyway, so the image's totals come for free
+        uint64_t totalBytes = 0;
+        uint64_t totalFiles = 0;
+        for (std::size_t i=0; i<entries.size(); ++i) {
+            if (!entries[i].dirent.isDirectory()) {
+                totalBytes += entries[i].dirent.getFileSize();
+                ++totalFiles;
+            }
+        }
+        progress.addTotal(totalBytes, totalFiles);
+
+        uint64_t available;
+        if (!dryRun && checkSpace && availableSpace(dirname, available)) {
+            uint64_t required = requiredSpace(entries, dirname + "/");
+            if (required > available) {
+                logger.write(Logger::LEVEL_ERROR, "ERROR: Extracting '" + filename + "' requires " + std::to_string(required)
+                             + " bytes, but only " + std::to_string(available) + " bytes are available");
+                return 1;
+            }
+        }
+
+        extraction.deduplicator.setMethod(dedupMethod, dedupContent);
+        if (extraction.deduplicator.isEnabled())
+            extraction.deduplicator.prepare(isofile, entries);
+
+        handleDirectoryEntry(extraction, de, dirname + "/");
+
+        if (journal.isOpen())
+            journal.checkpoint();
+
+        if (printStats) {
+            std::string report = stats.report(filename);
+            logger.write(Logger::LEVEL_INFO, report.substr(0, report.find_last_not_of('\n') + 1));
+        }
+    } catch (xdvdfs::Exception* e) {
+        logger.write(Logger::LEVEL_ERROR, "ERROR: Extracting '" + filename + "' failed: " + e->what());
+        delete e;
+        return 1;
+    } catch (std::exception& e) {
+        logger.write(Logger::LEVEL_ERROR, "ERROR: Extracting '" + filename + "' failed: " + e.what());
+        return 1;
+    }
+
+    return 0;
+}
+
+void handleDirectoryEntry (Extraction& extraction, xdvdfs::DirectoryEntry& dirent, const std::string& path)
+{
+    std::ifstream& file = extraction.file;
+    Statistics& stats = extraction.stats;
+
     if (dirent.isDirectory())
     {
-        std::cout << "creating directory " << dirent.getFilename() << std::endl;
+        logger.write(Logger::LEVEL_INFO, "creating directory " + dirent.getFilename());
+
+        std::string dirname = path + dirent.getFilename();
+        Tracer::Span span(tracer, "extract", "directory", dirname);
+        ++stats.directories;
 
         if (!dryRun) {
-            mkdir(dirent.getFilename().c_str(), 0755);
-            chdir(dirent.getFilename().c_str());
+            Statistics::Timer timer(stats, Statistics::DIRECTORIES);
+            mkdir(dirname.c_str(), 0755);
         }
 
-        xdvdfs::DirectoryEntry de = dirent.getFirstEntry(file);
-        handleDirectoryEntry(file, de);
+        // empty directories don't have a directory table
+        if (dirent.getFileSize() > 0)
+        {
+            Statistics::Clock::time_point start = Statistics::Clock::now();
+            xdvdfs::DirectoryEntry de = dirent.getFirstEntry(file);
+            stats.add(Statistics::TRAVERSAL, start);
 
-        if (!dryRun)
-            chdir("..");
+            handleDirectoryEntry(extraction, de, dirname + "/");
+        }
     }
     else
     {
-        std::cout << "extracting " << dirent.getFilename() << std::endl;
+        ++stats.files;
+        extractFileEntry(extraction, dirent, path);
+    }
 
-        if (!dryRun)
+    if (dirent.hasLeftChild())
+    {
+        Statistics::Clock::time_point start = Statistics::Clock::now();
+        xdvdfs::DirectoryEntry de = dirent.getLeftChild(file);
+        stats.add(Statistics::TRAVERSAL, start);
+
+        handleDirectoryEntry(extraction, de, path);
+    }
+
+    if (dirent.hasRightChild())
+    {
+        Statistics::Clock::time_point start = Statistics::Clock::now();
+        xdvdfs::DirectoryEntry de = dirent.getRightChild(file);
+        stats.add(Statistics::TRAVERSAL, start);
+
+        handleDirectoryEntry(extraction, de, path);
+    }
+}
+
+void extractFileEntry (Extraction& extraction, xdvdfs::DirectoryEntry& dirent, const std::string& path)
+{
+    std::ifstream& file = extraction.file;
+    Deduplicator& deduplicator = extraction.deduplicator;
+    std::string filename = path + dirent.getFilename();
+    Tracer::Span span(tracer, "extract", "file", filename);
+    bool resumed = journal.isComplete(filename, dirent.getFileSize()) && isUpToDate(file, dirent, filename, false);
+    bool upToDate = resumed || (incrementalMode != INCREMENTAL_OFF && isUpToDate(file, dirent, filename, incrementalMode == INCREMENTAL_SAMPLE));
+
+    // data shared with a file extracted before gets linked instead of written again
+    const Deduplicator::Target* target = (upToDate || dryRun) ? nullptr : deduplicator.find(dirent);
+    if (target && deduplicator.link(target->filename, filename))
+    {
+        logger.write(Logger::LEVEL_INFO, "linking " + dirent.getFilename());
+
+        if (manifest.is_open())
+            writeManifestEntry(target->hashes, filename);
+
+        if (journal.isOpen())
+            journal.record(filename, dirent.getFileSize());
+
+        progress.addBytes(dirent.getFileSize());
+        progress.addFile();
+        return;
+    }
+
+    std::map<std::string, verify::Expected>::iterator previous = previousManifest.find(filename);
+    bool compare = manifest.is_open() && upToDate && !resumed && previous != previousManifest.end();
+    bool write = !dryRun && !upToDate;
+
+    if (!write && !manifest.is_open())
+    {
+        if (upToDate)
         {
-            std::ofstream efile;
-            efile.open(dirent.getFilename().c_str(), efile.out | efile.binary | efile.trunc);
+            logger.write(Logger::LEVEL_VERBOSE, "skipping " + dirent.getFilename());
 
-            if (!efile.is_open()) {
-                std::cerr << "failed to open file '" << dirent.getFilename() << "'" << std::endl;
+            // later files sharing the data can still be linked to the existing copy
+            if (!dryRun)
+            {
+                Deduplicator::Target existing;
+                existing.filename = filename;
+                deduplicator.remember(dirent, existing);
             }
+        }
+
+        progress.addBytes(dirent.getFileSize());
+    }
+    else
+    {
+        hash::FileHashes hashes;
+
+        if (write)
+            logger.write(Logger::LEVEL_INFO, "extracting " + dirent.getFilename());
+
+        // hash the data on its way to the output file, so it's only read once
+        copyData(extraction, dirent, write ? &filename : nullptr, manifest.is_open() ? &hashes : nullptr);
+
+        Deduplicator::Target result;
+        result.filename = filename;
+        result.hashes.size = dirent.getFileSize();
+
+        if (manifest.is_open())
+        {
+            result.hashes.crc32 = hashes.crc32.hexdigest();
+            result.hashes.md5 = hashes.md5.hexdigest();
+            result.hashes.sha1 = hashes.sha1.hexdigest();
 
-            dirent.extractFile(file, efile);
+            // the size matched, but the contents differ from the last extraction
+            if (compare && !verify::matches(previous->second, result.hashes) && !dryRun)
+            {
+                logger.write(Logger::LEVEL_INFO, "extracting " + dirent.getFilename());
+
+                // the file is read a second time, which wasn't part of the total
+                progress.addTotal(dirent.getFileSize(), 0);
+                copyData(extraction, dirent, &filename, nullptr);
+                write = true;
+            }
+
+            writeManifestEntry(result.hashes, filename);
         }
+
+        if (write && journal.isOpen())
+            journal.record(filename, dirent.getFileSize());
+
+        if (!dryRun)
+            deduplicator.remember(dirent, result);
     }
 
-    if (dirent.hasLeftChild())
+    progress.addFile();
+}
+
+/**
+ * Streams the data of a file from the image into the output file and the
+ * hashes. Each of them can be null.
+*/
+void copyData (Extraction& extraction, xdvdfs::DirectoryEntry& dirent, const std::string* filename, hash::FileHashes* hashes)
+{
+    Statistics& stats = extraction.stats;
+    std::ofstream efile;
+
+    if (filename)
     {
-        xdvdfs::DirectoryEntry de = dirent.getLeftChild(file);
-        handleDirectoryEntry(file, de);
+        Statistics::Timer timer(stats, Statistics::OPEN);
+
+        // an earlier extraction may have linked the file to another one, which mustn't change with it
+        std::remove(filename->c_str());
+        efile.open(filename->c_str(), efile.out | efile.binary | efile.trunc);
+
+        if (!efile.is_open()) {
+            logger.write(Logger::LEVEL_ERROR, "failed to open file '" + *filename + "'");
+        }
     }
 
-    if (dirent.hasRightChild())
+#if defined __linux__
+    // allocating the whole file up front avoids fragmentation, but would fill the holes
+    if (efile.is_open() && !sparseOutput && dirent.getFileSize() > 0)
     {
-        xdvdfs::DirectoryEntry de = dirent.getRightChild(file);
-        handleDirectoryEntry(file, de);
+        Statistics::Timer timer(stats, Statistics::OPEN);
+        int fd = open(filename->c_str(), O_WRONLY);
+        if (fd >= 0)
+        {
+            posix_fallocate(fd, 0, dirent.getFileSize());
+            close(fd);
+        }
+    }
+#endif
+
+    bool holeAtEnd = false;
+
+    // the time between two chunks is spent reading the next one
+    Statistics::Clock::time_point readStart = Statistics::Clock::now();
+
+    dirent.readData(extraction.file, [&] (const char* data, std::size_t length) {
+        stats.add(Statistics::READ, readStart);
+        if (tracer.isOpen())
+            tracer.complete("io", "read", readStart);
+        stats.bytesRead += length;
+        ++stats.readChunks;
+        progress.addBytes(length);
+
+        readLimit.acquire(length);
+        iopsLimit.acquire(1);
+
+        if (hashes)
+            hashes->update(data, length);
+
+        if (!efile.is_open())
+            return;
+
+        writeLimit.acquire(length);
+        iopsLimit.acquire(1);
+
+        // skipping zero blocks leaves holes in the file instead of allocated zeros
+        holeAtEnd = sparseOutput && isZero(data, length);
+        if (holeAtEnd)
+        {
+            efile.seekp(length, efile.cur);
+        }
+        else
+        {
+            Statistics::Timer timer(stats, Statistics::WRITE);
+            Tracer::Span span(tracer, "io", "write");
+            efile.write(data, length);
+            stats.bytesWritten += length;
+            ++stats.writeChunks;
+        }
+
+        readStart = Statistics::Clock::now();
+    });
+
+    // the file only gets its full size if its last byte is written
+    if (holeAtEnd)
+    {
+        efile.seekp(-1, efile.cur);
+        efile.put(0);
+    }
+
+    if (efile.is_open())
+    {
+        // closing flushes the stream buffer, which is part of writing
+        Statistics::Timer timer(stats, Statistics::WRITE);
+        Tracer::Span span(tracer, "io", "close");
+        efile.close();
+    }
+}
+
+/**
+ * Returns the number of bytes needed to extract the files. Existing outputs
+ * get truncated, so the space they occupy is available.
+*/
+uint64_t requiredSpace (std::vector<xdvdfs::TreeEntry>& entries, const std::string& prefix)
+{
+    uint64_t required = 0;
+
+    for (std::size_t i=0; i<entries.size(); ++i)
+    {
+        if (entries[i].dirent.isDirectory())
+            continue;
+
+        uint64_t size = entries[i].dirent.getFileSize();
+        uint64_t existing = 0;
+
+        struct stat st;
+        if (stat((prefix + entries[i].path).c_str(), &st) == 0)
+            existing = st.st_size;
+
+        if (size > existing)
+            required += size - existing;
+    }
+
+    return required;
+}
+
+/**
+ * Determines the free space of the filesystem the directory is on. Returns
+ * false if it can't be determined.
+*/
+bool availableSpace (const std::string& directory, uint64_t& bytes)
+{
+    std::string path = directory;
+
+    // the output directory might not exist yet, so fall back to its parent
+    while (true)
+    {
+#if defined _WIN32
+        ULARGE_INTEGER available;
+        if (GetDiskFreeSpaceExA(path.c_str(), &available, NULL, NULL))
+        {
+            bytes = available.QuadPart;
+            return true;
+        }
+#else
+        struct statvfs st;
+        if (statvfs(path.c_str(), &st) == 0)
+        {
+            bytes = static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+            return true;
+        }
+#endif
+
+        std::size_t pos = path.find_last_of("/\\");
+        if (path == ".")
+            return false;
+
+        path = (pos == std::string::npos) ? "." : (pos == 0 ? "/" : path.substr(0, pos));
+    }
+}
+
+/**
+ * Returns true if the block only contains zero bytes. The block is checked a
+ * word at a time, which compilers turn into vector instructions.
+*/
+bool isZero (const char* data, std::size_t length)
+{
+    uint64_t accumulator = 0;
+    std::size_t i = 0;
+
+    for (; i + 8*sizeof(uint64_t) <= length; i += 8*sizeof(uint64_t))
+    {
+        uint64_t words[8];
+        std::memcpy(words, data+i, sizeof(words));
+        for (int w=0; w<8; ++w)
+            accumulator |= words[w];
+
+        if (accumulator != 0)
+            return false;
+    }
+
+    for (; i<length; ++i)
+        accumulator |= static_cast<unsigned char>(data[i]);
+
+    return accumulator == 0;
+}
+
+void writeManifestEntry (const verify::Result& result, const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(manifestMutex);
+    manifest << result.crc32 << " " << result.md5 << " " << result.sha1 << " " << result.size << " " << filename << "\n";
+}
+
+/**
+ * Checks whether a previous extraction left a matching file behind. The size
+ * has to match, in sample mode the first, middle and last block as well.
+*/
+bool isUpToDate (std::ifstream& file, xdvdfs::DirectoryEntry& dirent, const std::string& filename, bool sample)
+{
+    std::ifstream existing(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+    if (!existing.is_open() || existing.tellg() != dirent.getFileSize())
+        return false;
+
+    if (!sample)
+        return true;
+
+    static const std::streamsize SAMPLE_SIZE = 64*1024;
+    std::streamsize size = dirent.getFileSize();
+    std::streamsize length = std::min(size, SAMPLE_SIZE);
+    std::streamoff samples[] = {0, (size - length) / 2, size - length};
+    std::vector<char> expected(length), actual(length);
+
+    for (std::size_t i=0; i<sizeof(samples)/sizeof(samples[0]) && length > 0; ++i)
+    {
+        file.seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * dirent.getStartSector() + samples[i]);
+        file.read(expected.data(), length);
+
+        existing.seekg(samples[i]);
+        if (!existing.read(actual.data(), length) || expected != actual)
+            return false;
     }
+
+    return true;
+}
+
+void writeTar (std::ifstream& file, xdvdfs::VolumeDescriptor& vd, const std::string& prefix, tar::Writer& writer)
+{
+    std::vector<xdvdfs::TreeEntry> entries;
+    xdvdfs::DirectoryEntry root = vd.getRootDirEntry(file);
+    xdvdfs::listTree(file, root, entries);
+
+    std::time_t mtime = vd.getCreationTime();
+    writer.addDirectory(prefix, mtime);
+
+    // directories come first, so they exist before any file inside of them
+    for (std::size_t i=0; i<entries.size(); ++i)
+    {
+        if (entries[i].dirent.isDirectory())
+            writer.addDirectory(prefix + "/" + entries[i].path, mtime);
+    }
+
+    // files are written in the order of their data on the image to avoid seeking
+    std::vector<xdvdfs::TreeEntry*> files;
+    for (std::size_t i=0; i<entries.size(); ++i)
+    {
+        if (!entries[i].dirent.isDirectory())
+            files.push_back(&entries[i]);
+    }
+
+    std::stable_sort(files.begin(), files.end(), [] (xdvdfs::TreeEntry* a, xdvdfs::TreeEntry* b) {
+        return a->dirent.getStartSector() < b->dirent.getStartSector();
+    });
+
+    for (std::size_t i=0; i<files.size(); ++i)
+    {
+        logger.write(Logger::LEVEL_VERBOSE, "adding " + files[i]->path);
+
+        writer.beginFile(prefix + "/" + files[i]->path, files[i]->dirent.getFileSize(), mtime);
+        files[i]->dirent.extractFile(file, std::cout);
+        writer.endFile();
+    }
+}
+
+/**
+ * Reads a hash list or manifest, reporting why if it can't be used.
+*/
+bool readHashList (const std::string& filename, std::vector<verify::Expected>& entries)
+{
+    try {
+        verify::loadHashList(filename, entries);
+    } catch (xdvdfs::Exception* e) {
+        logger.write(Logger::LEVEL_ERROR, "ERROR: Reading '" + filename + "' failed: " + e->what());
+        delete e;
+        return false;
+    } catch (std::exception& e) {
+        logger.write(Logger::LEVEL_ERROR, "ERROR: Reading '" + filename + "' failed: " + e.what());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Hashes an image (and optionally its files) and checks the results against
+ * the hash list. Without a list, the hashes are printed in manifest format.
+ * Returns the number of mismatches and missing entries.
+*/
+int verifyImage (std::ifstream& file, xdvdfs::VolumeDescriptor& vd, const std::string& filename, const std::string& prefix,
+                 const std::vector<verify::Expected>& expected, bool checkList, bool checkFiles)
+{
+    std::vector<xdvdfs::TreeEntry> entries, files;
+    if (checkFiles)
+    {
+        xdvdfs::DirectoryEntry root = vd.getRootDirEntry(file);
+        xdvdfs::listTree(file, root, entries);
+
+        for (std::size_t i=0; i<entries.size(); ++i)
+        {
+            if (!entries[i].dirent.isDirectory())
+                files.push_back(entries[i]);
+        }
+    }
+
+    verify::Result image;
+    std::vector<verify::Result> results;
+    verify::hashImage(file, image, files, results);
+
+    std::string basename = filename.substr(filename.find_last_of("/\\") + 1);
+
+    if (!checkList)
+    {
+        std::cout << image.crc32 << " " << image.md5 << " " << image.sha1 << " " << image.size << " " << basename << "\n";
+        for (std::size_t i=0; i<files.size(); ++i)
+        {
+            std::cout << results[i].crc32 << " " << results[i].md5 << " " << results[i].sha1 << " "
+                      << results[i].size << " " << prefix << "/" << files[i].path << "\n";
+        }
+        std::cout.flush();
+        return 0;
+    }
+
+    int failures = 0;
+
+    // the image is looked up by name first; images are often renamed, so fall back to its hashes
+    const verify::Expected* match = nullptr;
+    bool found = false;
+    for (std::size_t i=0; i<expected.size() && !found; ++i)
+    {
+        std::string name = expected[i].name.substr(expected[i].name.find_last_of("/\\") + 1);
+        if (name == basename)
+        {
+            found = true;
+            if (verify::matches(expected[i], image))
+                match = &expected[i];
+        }
+    }
+
+    for (std::size_t i=0; i<expected.size() && !found; ++i)
+    {
+        if (verify::matches(expected[i], image) && (!expected[i].md5.empty() || !expected[i].sha1.empty() || !expected[i].crc32.empty()))
+        {
+            found = true;
+            match = &expected[i];
+        }
+    }
+
+    if (match)
+        std::cout << "OK " << filename << " (" << match->name << ")" << std::endl;
+    else if (found)
+        std::cout << "MISMATCH " << filename << std::endl;
+    else
+        std::cout << "MISSING " << filename << std::endl;
+
+    if (!match)
+        ++failures;
+
+    // the names are normalized once; the first entry of a name wins
+    std::unordered_map<std::string, std::size_t> byName;
+    for (std::size_t j=0; j<expected.size() && !files.empty(); ++j)
+    {
+        std::string name = expected[j].name;
+        std::replace(name.begin(), name.end(), '\\', '/');
+        byName.insert(std::make_pair(name, j));
+    }
+
+    for (std::size_t i=0; i<files.size(); ++i)
+    {
+        std::string path = prefix + "/" + files[i].path;
+        const verify::Expected* entry = nullptr;
+
+        // lists may name files with or without the image's directory
+        std::unordered_map<std::string, std::size_t>::const_iterator withPrefix = byName.find(path);
+        std::unordered_map<std::string, std::size_t>::const_iterator withoutPrefix = byName.find(files[i].path);
+        if (withPrefix != byName.end() && (withoutPrefix == byName.end() || withPrefix->second < withoutPrefix->second))
+            entry = &expected[withPrefix->second];
+        else if (withoutPrefix != byName.end())
+            entry = &expected[withoutPrefix->second];
+
+        if (entry && verify::matches(*entry, results[i]))
+        {
+            if (verbosityLevel > 0)
+                std::cout << "OK " << path << "\n";
+            continue;
+        }
+
+        std::cout << (entry ? "MISMATCH " : "MISSING ") << path << "\n";
+        ++failures;
+    }
+
+    std::cout.flush();
+    return failures;
 }
@@ -0,0 +1,344 @@
+/*
+ * xbisofs - read-only FUSE filesystem for XDVDFS images
+ * Copyright (C) 2015 Stefan Schmidt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*/
+
+#define FUSE_USE_VERSION 31
+
+#include "xdvdfs.hpp"
+#include <fuse.h>
+#include <string>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * A node of the in-memory directory index. Nodes are created on the first
+ * lookup and never freed while the filesystem is mounted.
+*/
+struct Node
+{
+    xdvdfs::DirectoryEntry dirent;
+    bool isRoot;
+    bool listed;                                        ///< true once names holds all children
+    std::vector<std::string> names;                     ///< children in directory table order
+    std::map<std::string, std::unique_ptr<Node> > children; ///< cached children by upper case name
+};
+
+struct Image
+{
+    std::ifstream file;         ///< used for metadata only, guarded by mutex
+    std::mutex mutex;
+    int fd;                     ///< used for file data with positional reads
+    std::time_t mtime;
+    Node root;
+};
+
+static Image image;
+
+static std::string upperCase (const std::string& name)
+{
+    std::string result(name);
+    for (std::size_t i=0; i<result.size(); ++i)
+        result[i] = std::toupper(static_cast<unsigned char>(result[i]));
+    return result;
+}
+
+static bool isDirectory (Node* node)
+{
+    return node->isRoot || node->dirent.isDirectory();
+}
+
+static bool hasTable (Node* node)
+{
+    return node->isRoot || node->dirent.getFileSize() > 0;
+}
+
+/**
+ * Looks up a child of a directory node, descending the on-disk binary search
+ * tree on a cache miss. Must be called with the image mutex held.
+*/
+static Node* findChild (Node* dir, const std::string& name)
+{
+    std::string key = upperCase(name);
+    auto it = dir->children.find(key);
+    if (it != dir->children.end())
+        return it->second.get();
+
+    if (!isDirectory(dir) || !hasTable(dir))
+        return nullptr;
+
+    xdvdfs::DirectoryEntry first = dir->isRoot ? dir->dirent : dir->dirent.getFirstEntry(image.file);
+    xdvdfs::DirectoryEntry result;
+    if (!first.findEntry(image.file, name, result))
+        return nullptr;
+
+    std::unique_ptr<Node> node(new Node());
+    node->dirent = result;
+    node->isRoot = false;
+    node->listed = false;
+
+    Node* ptr = node.get();
+    dir->children[key] = std::move(node);
+    return ptr;
+}
+
+static Node* resolve (const char* path)
+{
+    std::lock_guard<std::mutex> lock(image.mutex);
+    Node* node = &image.root;
+    std::string p(path);
+    std::size_t start = 0;
+
+    try
+    {
+        while (node && start < p.size())
+        {
+            std::size_t end = p.find('/', start);
+            if (end == std::string::npos)
+                end = p.size();
+
+            if (end > start)
+                node = findChild(node, p.substr(start, end-start));
+
+            start = end + 1;
+        }
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+
+    return node;
+}
+
+static void collectNames (std::ifstream& file, xdvdfs::DirectoryEntry& dirent, std::vector<std::string>& names)
+{
+    names.push_back(dirent.getFilename());
+
+    if (dirent.hasLeftChild())
+    {
+        xdvdfs::DirectoryEntry de = dirent.getLeftChild(file);
+        collectNames(file, de, names);
+    }
+
+    if (dirent.hasRightChild())
+    {
+        xdvdfs::DirectoryEntry de = dirent.getRightChild(file);
+        collectNames(file, de, names);
+    }
+}
+
+static void fillStat (Node* node, struct stat* st)
+{
+    std::memset(st, 0, sizeof(*st));
+
+    if (isDirectory(node))
+    {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+    }
+    else
+    {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = node->dirent.getFileSize();
+        st->st_blocks = (st->st_size + 511) / 512;
+    }
+
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_mtime = image.mtime;
+    st->st_atime = image.mtime;
+    st->st_ctime = image.mtime;
+}
+
+static int xbisofs_getattr (const char* path, struct stat* st, struct fuse_file_info* fi)
+{
+    (void) fi;
+    Node* node = resolve(path);
+    if (!node)
+        return -ENOENT;
+
+    fillStat(node, st);
+    return 0;
+}
+
+static int xbisofs_readdir (const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi, enum fuse_readdir_flags flags)
+{
+    (void) offset; (void) fi; (void) flags;
+    Node* node = resolve(path);
+    if (!node)
+        return -ENOENT;
+
+    if (!isDirectory(node))
+        return -ENOTDIR;
+
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lock(image.mutex);
+
+        if (!node->listed && hasTable(node))
+        {
+            try
+            {
+                xdvdfs::DirectoryEntry first = node->isRoot ? node->dirent : node->dirent.getFirstEntry(image.file);
+                collectNames(image.file, first, node->names);
+            }
+            catch (...)
+            {
+                node->names.clear();
+                return -EIO;
+            }
+        }
+
+        node->listed = true;
+        names = node->names;
+    }
+
+    filler(buf, ".", nullptr, 0, static_cast<enum fuse_fill_dir_flags>(0));
+    filler(buf, "..", nullptr, 0, static_cast<enum fuse_fill_dir_flags>(0));
+
+    for (std::size_t i=0; i<names.size(); ++i)
+        filler(buf, names[i].c_str(), nullptr, 0, static_cast<enum fuse_fill_dir_flags>(0));
+
+    return 0;
+}
+
+static int xbisofs_open (const char* path, struct fuse_file_info* fi)
+{
+    Node* node = resolve(path);
+    if (!node)
+        return -ENOENT;
+
+    if (isDirectory(node))
+        return -EISDIR;
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EROFS;
+
+    fi->fh = reinterpret_cast<uint64_t>(node);
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static int xbisofs_read (const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi)
+{
+    (void) path;
+    Node* node = reinterpret_cast<Node*>(fi->fh);
+    off_t fileSize = node->dirent.getFileSize();
+
+    if (offset >= fileSize)
+        return 0;
+
+    if (offset + static_cast<off_t>(size) > fileSize)
+        size = fileSize - offset;
+
+    // positional reads don't share a file offset, so reads can run in parallel
+    off_t base = static_cast<off_t>(node->dirent.getStartSector()) * xdvdfs::SECTOR_SIZE;
+    size_t done = 0;
+
+    while (done < size)
+    {
+        ssize_t r = pread(image.fd, buf+done, size-done, base+offset+done);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (r == 0)
+            break;
+        done += r;
+    }
+
+    return done;
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: xbisofs image mountpoint [fuse options]" << std::endl;
+        return 1;
+    }
+
+    image.file.open(argv[1], image.file.binary | image.file.in);
+    if (!image.file.is_open())
+    {
+        std::cerr << "ERROR: Could not open file '" << argv[1] << "'" << std::endl;
+        return 1;
+    }
+
+    image.file.exceptions(image.file.failbit | image.file.badbit | image.file.eofbit);
+
+    try
+    {
+        xdvdfs::VolumeDescriptor vd;
+        vd.readFromFile(image.file);
+        vd.validate();
+
+        image.root.dirent = vd.getRootDirEntry(image.file);
+        image.mtime = vd.getCreationTime();
+    }
+    catch (xdvdfs::Exception* e)
+    {
+        std::cerr << "ERROR: " << e->what() << std::endl;
+        delete e;
+        return 1;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "ERROR: Could not read image: " << e.what() << std::endl;
+        return 1;
+    }
+
+    image.root.isRoot = true;
+    image.root.listed = false;
+
+    image.fd = open(argv[1], O_RDONLY);
+    if (image.fd < 0)
+    {
+        std::cerr << "ERROR: Could not open file '" << argv[1] << "'" << std::endl;
+        return 1;
+    }
+
+    struct fuse_operations ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.getattr = xbisofs_getattr;
+    ops.readdir = xbisofs_readdir;
+    ops.open = xbisofs_open;
+    ops.read = xbisofs_read;
+
+    // the image argument isn't meant for fuse
+    std::vector<char*> args;
+    args.push_back(argv[0]);
+    args.push_back(const_cast<char*>("-o"));
+    args.push_back(const_cast<char*>("ro"));
+    for (int i=2; i<argc; ++i)
+        args.push_back(argv[i]);
+
+    int ret = fuse_main(static_cast<int>(args.size()), args.data(), &ops, nullptr);
+
+    close(image.fd);
+    return ret;
+}
@@ -1,10 +1,41 @@
 #include "xdvdfs.hpp"
 
 #include <vector>
+#include <algorithm>
+#include <cctype>
 #include <cstring>
 #include <iostream>
 
-// TODO: support for big endian architectures
+/**
+ * Compares two filenames the way the directory tables are sorted: byte-wise
+ * after converting to upper case, with a prefix ordered before longer names.
+*/
+int xdvdfs::compareFilenames (const std::string& a, const std::string& b)
+{
+    NameView va = {a.data(), a.size()};
+    NameView vb = {b.data(), b.size()};
+
+    return compareFilenames(va, vb);
+}
+
+int xdvdfs::compareFilenames (const xdvdfs::NameView& a, const xdvdfs::NameView& b)
+{
+    std::size_t length = std::min(a.size, b.size);
+
+    for (std::size_t i=0; i<length; ++i)
+    {
+        int ca = std::toupper(static_cast<unsigned char>(a.data[i]));
+        int cb = std::toupper(static_cast<unsigned char>(b.data[i]));
+
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+
+    if (a.size == b.size)
+        return 0;
+
+    return a.size < b.size ? -1 : 1;
+}
 
 void xdvdfs::VolumeDescriptor::readFromFile (std::ifstream& file)
 {
@@ -14,16 +45,11 @@ void xdvdfs::VolumeDescriptor::readFromFile (std::ifstream& file)
     file.seekg(VOLUME_DESCRIPTOR_SECTOR*SECTOR_SIZE, file.beg);
     file.read(buffer.data(), buffer.size());
 
-    // TODO: couldn't we use the stream operator instead?
     std::copy(buffer.begin(), buffer.begin()+0x14, this->magicNumber);
-    std::copy(buffer.begin()+0x14, buffer.begin()+0x18, reinterpret_cast<char*>(&this->rootDirTableSector));
-    std::copy(buffer.begin()+0x18, buffer.begin()+0x1C, reinterpret_cast<char*>(&this->rootDirTableSize));
+    this->rootDirTableSector = load_le<uint32_t>(&buffer[0x14]);
+    this->rootDirTableSize = load_le<uint32_t>(&buffer[0x18]);
     std::copy(buffer.begin()+0x1C, buffer.begin()+0x24, this->filetime);
     std::copy(buffer.begin()+0x7EC, buffer.end(), this->magicNumber2);
-
-    // endianess conversion
-    this->rootDirTableSector = le_to_host(this->rootDirTableSector);
-    this->rootDirTableSize = le_to_host(this->rootDirTableSize);
 }
 
 void xdvdfs::VolumeDescriptor::validate ()
@@ -47,6 +73,30 @@ xdvdfs::DirectoryEntry xdvdfs::VolumeDescriptor::getRootDirEntry (std::ifstream&
     return dirent;
 }
 
+uint32_t xdvdfs::VolumeDescriptor::getRootDirTableSector ()
+{
+    return this->rootDirTableSector;
+}
+
+uint32_t xdvdfs::VolumeDescriptor::getRootDirTableSize ()
+{
+    return this->rootDirTableSize;
+}
+
+std::time_t xdvdfs::VolumeDescriptor::getCreationTime ()
+{
+    uint64_t ft = load_le<uint64_t>(this->filetime);
+
+    // FILETIME counts 100ns intervals since 1601-01-01
+    static const uint64_t EPOCH_DIFFERENCE = 11644473600ULL;
+    uint64_t seconds = ft / 10000000ULL;
+
+    if (seconds < EPOCH_DIFFERENCE)
+        return 0;
+
+    return static_cast<std::time_t>(seconds - EPOCH_DIFFERENCE);
+}
+
 void xdvdfs::DirectoryEntry::readFromFile (std::ifstream& file, std::streampos sector, std::streampos offset)
 {
     std::vector<char> buffer(2048);
@@ -55,23 +105,17 @@ void xdvdfs::DirectoryEntry::readFromFile (std::ifstream& file, std::streampos s
     file.seekg(sector*xdvdfs::SECTOR_SIZE + offset, file.beg);
     file.read(buffer.data(), buffer.size());
 
-    std::copy(buffer.begin(), buffer.begin()+0x02, reinterpret_cast<char*>(&this->leftSubTree));
-    std::copy(buffer.begin()+0x02, buffer.begin()+0x04, reinterpret_cast<char*>(&this->rightSubTree));
-    std::copy(buffer.begin()+0x04, buffer.begin()+0x08, reinterpret_cast<char*>(&this->startSector));
-    std::copy(buffer.begin()+0x08, buffer.begin()+0x0C, reinterpret_cast<char*>(&this->fileSize));
-    std::copy(buffer.begin()+0x0C, buffer.begin()+0x0D, reinterpret_cast<char*>(&this->attributes));
+    this->leftSubTree = load_le<uint16_t>(&buffer[0x00]);
+    this->rightSubTree = load_le<uint16_t>(&buffer[0x02]);
+    this->startSector = load_le<uint32_t>(&buffer[0x04]);
+    this->fileSize = load_le<uint32_t>(&buffer[0x08]);
+    this->attributes = load_le<uint8_t>(&buffer[0x0C]);
 
     // reading the filename requires a bit more work
     uint8_t* filenameLength = reinterpret_cast<uint8_t*>(&buffer[0x0D]);
     this->filename = std::string(&buffer[0x0E], *filenameLength);
 
     this->sectorNumber = sector;
-
-    // endianess conversion
-    this->leftSubTree = le_to_host(this->leftSubTree);
-    this->rightSubTree = le_to_host(this->rightSubTree);
-    this->startSector = le_to_host(this->startSector);
-    this->fileSize = le_to_host(this->fileSize);
 }
 
 std::string xdvdfs::DirectoryEntry::getFilename ()
@@ -84,30 +128,44 @@ std::streamsize xdvdfs::DirectoryEntry::getFileSize()
     return this->fileSize;
 }
 
-void xdvdfs::DirectoryEntry::extractFile(std::ifstream& file, std::ofstream& ofile)
+uint32_t xdvdfs::DirectoryEntry::getStartSector ()
+{
+    return this->startSector;
+}
+
+uint8_t xdvdfs::DirectoryEntry::getAttributes ()
+{
+    return this->attributes;
+}
+
+void xdvdfs::DirectoryEntry::extractFile(std::ifstream& file, std::ostream& ofile)
+{
+    this->readData(file, [&ofile] (const char* data, std::size_t length) {
+        ofile.write(data, length);
+    });
+}
+
+/**
+ * Reads the file's data in chunks of up to bufferSize bytes and passes every
+ * chunk to the callback.
+*/
+void xdvdfs::DirectoryEntry::readData(std::ifstream& file, const std::function<void (const char*, std::size_t)>& callback, std::size_t bufferSize)
 {
     if (this->isDirectory())
         throw new xdvdfs::Exception("Tried to access directory as a file");
 
-    std::vector<char> buffer(4096);
+    std::vector<char> buffer(bufferSize);
     std::size_t filesize = this->fileSize;
 
-    file.seekg(xdvdfs::SECTOR_SIZE * this->startSector);
+    file.seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * this->startSector);
 
     while (filesize > 0)
     {
-        if (filesize > buffer.size())
-        {
-            file.read(buffer.data(), buffer.size());
-            ofile.write(buffer.data(), buffer.size());
-            filesize -= buffer.size();
-        }
-        else
-        {
-            file.read(buffer.data(), filesize);
-            ofile.write(buffer.data(), filesize);
-            filesize = 0;
-        }
+        std::size_t length = std::min(filesize, buffer.size());
+
+        file.read(buffer.data(), length);
+        callback(buffer.data(), length);
+        filesize -= length;
     }
 }
 
@@ -152,3 +210,226 @@ xdvdfs::DirectoryEntry xdvdfs::DirectoryEntry::getFirstEntry (std::ifstream& fil
 
     return dirent;
 }
+
+/**
+ * Searches the directory table this entry belongs to for the given name by
+ * descending the binary search tree, starting at this entry.
+*/
+bool xdvdfs::DirectoryEntry::findEntry (std::ifstream& file, const std::string& name, xdvdfs::DirectoryEntry& result)
+{
+    xdvdfs::DirectoryEntry dirent = *this;
+
+    while (true)
+    {
+        int cmp = compareFilenames(name, dirent.filename);
+
+        if (cmp == 0)
+        {
+            result = dirent;
+            return true;
+        }
+
+        if (cmp < 0 && dirent.hasLeftChild())
+            dirent = dirent.getLeftChild(file);
+        else if (cmp > 0 && dirent.hasRightChild())
+            dirent = dirent.getRightChild(file);
+        else
+            return false;
+    }
+}
+
+void xdvdfs::listTree (std::ifstream& file, xdvdfs::DirectoryEntry& dirent, std::vector<xdvdfs::TreeEntry>& entries, const std::string& prefix)
+{
+    xdvdfs::TreeEntry entry;
+    entry.path = prefix + dirent.getFilename();
+    entry.dirent = dirent;
+    entries.push_back(entry);
+
+    // empty directories don't have a directory table
+    if (dirent.isDirectory() && dirent.getFileSize() > 0)
+    {
+        xdvdfs::DirectoryEntry de = dirent.getFirstEntry(file);
+        listTree(file, de, entries, entry.path + "/");
+    }
+
+    if (dirent.hasLeftChild())
+    {
+        xdvdfs::DirectoryEntry de = dirent.getLeftChild(file);
+        listTree(file, de, entries, prefix);
+    }
+
+    if (dirent.hasRightChild())
+    {
+        xdvdfs::DirectoryEntry de = dirent.getRightChild(file);
+        listTree(file, de, entries, prefix);
+    }
+}
+
+/**
+ * Reads a whole directory table and decodes it. Empty directories don't have
+ * a table, their size is 0.
+*/
+void xdvdfs::DirectoryTable::read (std::ifstream& file, uint32_t sector, uint32_t size)
+{
+    this->data.resize(size);
+
+    if (size > 0)
+    {
+        file.seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * sector, file.beg);
+        file.read(this->data.data(), size);
+    }
+
+    this->decode();
+}
+
+/**
+ * Decodes the entries of the loaded table. Entries are 4 byte aligned and
+ * never cross a sector boundary; the rest of a sector is padded with 0xFF,
+ * which is skipped by jumping to the next sector.
+*/
+void xdvdfs::DirectoryTable::decode ()
+{
+    this->offsets.clear();
+    this->left.clear();
+    this->right.clear();
+    this->sectors.clear();
+    this->sizes.clear();
+    this->attributes.clear();
+    this->nameOffsets.clear();
+    this->nameLengths.clear();
+
+    const char* table = this->data.data();
+    std::size_t size = this->data.size();
+    std::size_t offset = 0;
+
+    while (offset + 0x0E <= size)
+    {
+        // a subtree offset of 0xFFFF can't be an entry, it's padding
+        if (static_cast<uint8_t>(table[offset]) == 0xFF && static_cast<uint8_t>(table[offset + 1]) == 0xFF)
+        {
+            offset = (offset / xdvdfs::SECTOR_SIZE + 1) * xdvdfs::SECTOR_SIZE;
+            continue;
+        }
+
+        uint8_t nameLength = static_cast<uint8_t>(table[offset + 0x0D]);
+        if (offset + 0x0E + nameLength > size)
+            throw new xdvdfs::Exception("Directory entry exceeds its table");
+
+        this->offsets.push_back(static_cast<uint32_t>(offset));
+        this->left.push_back(load_le<uint16_t>(table + offset));
+        this->right.push_back(load_le<uint16_t>(table + offset + 0x02));
+        this->sectors.push_back(load_le<uint32_t>(table + offset + 0x04));
+        this->sizes.push_back(load_le<uint32_t>(table + offset + 0x08));
+        this->attributes.push_back(static_cast<uint8_t>(table[offset + 0x0C]));
+        this->nameOffsets.push_back(static_cast<uint32_t>(offset + 0x0E));
+        this->nameLengths.push_back(nameLength);
+
+        offset = (offset + 0x0E + nameLength + 3) & ~static_cast<std::size_t>(3);
+    }
+}
+
+xdvdfs::NameView xdvdfs::DirectoryTable::name (std::size_t i) const
+{
+    NameView view;
+    view.data = this->data.data() + this->nameOffsets[i];
+    view.size = this->nameLengths[i];
+    return view;
+}
+
+void xdvdfs::TreeWalker::walk (std::ifstream& file, xdvdfs::VolumeDescriptor& vd, const xdvdfs::TreeWalker::Visitor& visitor)
+{
+    this->walk(file, vd.getRootDirTableSector(), vd.getRootDirTableSize(), visitor);
+}
+
+void xdvdfs::TreeWalker::walk (std::ifstream& file, uint32_t sector, uint32_t size, const xdvdfs::TreeWalker::Visitor& visitor)
+{
+    this->path.clear();
+    this->walkTable(file, 0, sector, size, visitor);
+}
+
+/**
+ * Visits the entries of one directory table by an in-order traversal of its
+ * binary search tree, using an explicit stack of entry offsets.
+*/
+void xdvdfs::TreeWalker::walkTable (std::ifstream& file, unsigned int depth, uint32_t sector, uint32_t size, const xdvdfs::TreeWalker::Visitor& visitor)
+{
+    // empty directories don't have a directory table
+    if (size == 0)
+        return;
+
+    if (this->tables.size() <= depth)
+    {
+        this->tables.resize(depth + 1);
+        this->stacks.resize(depth + 1);
+    }
+
+    // the outer vectors may grow while descending, so the buffers are always looked up by depth
+    this->tables[depth].resize(size);
+    this->stacks[depth].clear();
+
+    file.seekg(static_cast<std::streamoff>(xdvdfs::SECTOR_SIZE) * sector, file.beg);
+    file.read(this->tables[depth].data(), size);
+
+    std::size_t pathLength = this->path.size();
+    uint32_t offset = 0;
+    uint32_t visited = 0;
+    bool descending = true;
+
+    while (true)
+    {
+        const uint8_t* table = reinterpret_cast<const uint8_t*>(this->tables[depth].data());
+
+        // push the left spine of the current subtree
+        while (descending)
+        {
+            if (offset + 0x0E > size || offset + 0x0E + table[offset + 0x0D] > size)
+                throw new xdvdfs::Exception("Directory entry exceeds its table");
+
+            // a valid tree can't have more entries than fit into the table
+            if (++visited > size / 0x0E)
+                throw new xdvdfs::Exception("Directory table contains a cycle");
+
+            this->stacks[depth].push_back(offset);
+
+            uint16_t left = load_le<uint16_t>(reinterpret_cast<const char*>(table + offset));
+            if (left == 0)
+                break;
+
+            offset = static_cast<uint32_t>(left) * 4;
+        }
+
+        if (this->stacks[depth].empty())
+            break;
+
+        offset = this->stacks[depth].back();
+        this->stacks[depth].pop_back();
+
+        const uint8_t* entry = table + offset;
+        const char* fields = reinterpret_cast<const char*>(entry);
+        uint16_t right = load_le<uint16_t>(fields + 0x02);
+
+        EntryView view;
+        view.startSector = load_le<uint32_t>(fields + 0x04);
+        view.fileSize = load_le<uint32_t>(fields + 0x08);
+        view.attributes = entry[0x0C];
+        view.name.data = reinterpret_cast<const char*>(entry + 0x0E);
+        view.name.size = entry[0x0D];
+        view.depth = depth;
+
+        this->path.resize(pathLength);
+        this->path.append(view.name.data, view.name.size);
+        view.path.data = this->path.data();
+        view.path.size = this->path.size();
+
+        if (visitor(view) && view.isDirectory())
+        {
+            this->path += '/';
+            this->walkTable(file, depth + 1, view.startSector, view.fileSize, visitor);
+        }
+
+        descending = right != 0;
+        offset = static_cast<uint32_t>(right) * 4;
+    }
+
+    this->path.resize(pathLength);
+}
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <ctime>
 #include <exception>
 #include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
 
 namespace xdvdfs
 {
@@ -23,22 +29,63 @@ namespace xdvdfs
             std::string sDetails;
     };
 
-    template<typename T>
-    T le_to_host(T t)
+#if defined __BYTE_ORDER__ && defined __ORDER_BIG_ENDIAN__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    static const bool HOST_BIG_ENDIAN = true;
+#else
+    // all supported compilers without __BYTE_ORDER__ target little-endian Windows
+    static const bool HOST_BIG_ENDIAN = false;
+#endif
+
+    /**
+     * Reverses the byte order. GCC and Clang turn these into a single bswap
+     * instruction; they're constexpr, so constants get swapped at compile time.
+    */
+    constexpr uint8_t byteswap (uint8_t v)
     {
-        uint8_t *bptr = reinterpret_cast<uint8_t*>(&t);
-        T r = 0;
+        return v;
+    }
+
+    constexpr uint16_t byteswap (uint16_t v)
+    {
+        return static_cast<uint16_t>((v >> 8) | (v << 8));
+    }
 
-        for (std::size_t s=0; s<sizeof(T); ++s)
-        {
-            r |= bptr[s] << s*8;
-        }
+    constexpr uint32_t byteswap (uint32_t v)
+    {
+        return (v >> 24) | ((v >> 8) & 0x0000FF00u) | ((v << 8) & 0x00FF0000u) | (v << 24);
+    }
+
+    constexpr uint64_t byteswap (uint64_t v)
+    {
+        return (static_cast<uint64_t>(byteswap(static_cast<uint32_t>(v))) << 32) | byteswap(static_cast<uint32_t>(v >> 32));
+    }
+
+    /**
+     * Converts a little-endian value as stored in the image to the host's
+     * byte order. On little-endian hosts this is a no-op.
+    */
+    template<typename T>
+    constexpr T le_to_host (T t)
+    {
+        return HOST_BIG_ENDIAN ? byteswap(t) : t;
+    }
 
-        return r;
+    /**
+     * Loads a little-endian value from a possibly unaligned position in a
+     * buffer. The memcpy compiles to a plain load.
+    */
+    template<typename T>
+    T load_le (const char* data)
+    {
+        T t;
+        std::memcpy(&t, data, sizeof(T));
+        return le_to_host(t);
     }
 
     class DirectoryEntry;
 
+    int compareFilenames (const std::string& a, const std::string& b);
+
     /**
      * This class describes the volume descriptor of xdvdfs which is placed at
      * sector 32 of the image. It contains a zero-filled area to fill a whole
@@ -50,6 +97,9 @@ namespace xdvdfs
             void readFromFile (std::ifstream& file);
             void validate ();
             DirectoryEntry getRootDirEntry (std::ifstream& file);
+            uint32_t getRootDirTableSector ();
+            uint32_t getRootDirTableSize ();
+            std::time_t getCreationTime ();
 
         private:
             char magicNumber[0x14];         ///< 20 byte block containing the magic number
@@ -66,13 +116,17 @@ namespace xdvdfs
             void readFromFile (std::ifstream& file, std::streampos pos, std::streampos offset = 0);
             std::string getFilename ();
             std::streamsize getFileSize();
-            void extractFile(std::ifstream& file, std::ofstream& ofile);
+            uint32_t getStartSector ();
+            uint8_t getAttributes ();
+            void extractFile(std::ifstream& file, std::ostream& ofile);
+            void readData(std::ifstream& file, const std::function<void (const char*, std::size_t)>& callback, std::size_t bufferSize = 4096);
             bool isDirectory ();
             bool hasLeftChild ();
             bool hasRightChild ();
             DirectoryEntry getLeftChild (std::ifstream& file);
             DirectoryEntry getRightChild (std::ifstream& file);
             DirectoryEntry getFirstEntry (std::ifstream& file);
+            bool findEntry (std::ifstream& file, const std::string& name, DirectoryEntry& result);
 
             static const uint8_t FILE_READONLY  = 0x01;
             static const uint8_t FILE_HIDDEN    = 0x02;
@@ -91,4 +145,92 @@ namespace xdvdfs
 
             std::streampos sectorNumber;
     };
+
+    /**
+     * An entry of the flattened directory tree together with its path relative
+     * to the root directory, using '/' as separator.
+    */
+    struct TreeEntry
+    {
+        std::string path;
+        DirectoryEntry dirent;
+    };
+
+    void listTree (std::ifstream& file, DirectoryEntry& dirent, std::vector<TreeEntry>& entries, const std::string& prefix = "");
+
+    /**
+     * A string that isn't owned, pointing into a loaded directory table.
+    */
+    struct NameView
+    {
+        const char* data;
+        std::size_t size;
+
+        std::string str () const { return std::string(this->data, this->size); }
+    };
+
+    int compareFilenames (const NameView& a, const NameView& b);
+
+    /**
+     * All entries of a directory table, decoded in one linear pass into one
+     * array per field. The entries are in the order they are stored, not
+     * sorted; the offsets allow finding an entry referenced by the tree.
+    */
+    struct DirectoryTable
+    {
+        std::vector<char> data;             ///< the raw table, which the names point into
+        std::vector<uint32_t> offsets;      ///< byte offset of each entry within the table
+        std::vector<uint16_t> left;         ///< offsets of the subtrees in 4 byte units, 0 if none
+        std::vector<uint16_t> right;
+        std::vector<uint32_t> sectors;
+        std::vector<uint32_t> sizes;
+        std::vector<uint8_t> attributes;
+        std::vector<uint32_t> nameOffsets;
+        std::vector<uint8_t> nameLengths;
+
+        void read (std::ifstream& file, uint32_t sector, uint32_t size);
+        void decode ();
+        std::size_t size () const { return this->offsets.size(); }
+        bool isDirectory (std::size_t i) const { return (this->attributes[i] & DirectoryEntry::FILE_DIRECTORY) != 0; }
+        NameView name (std::size_t i) const;
+    };
+
+    /**
+     * An entry as seen by a TreeWalker visitor. The views are only valid
+     * during the call of the visitor.
+    */
+    struct EntryView
+    {
+        NameView name;
+        NameView path;              ///< path relative to the root directory, using '/' as separator
+        uint32_t startSector;
+        uint32_t fileSize;
+        uint8_t attributes;
+        unsigned int depth;         ///< 0 for the entries of the root directory
+
+        bool isDirectory () const { return (this->attributes & DirectoryEntry::FILE_DIRECTORY) != 0; }
+    };
+
+    /**
+     * This class walks a directory tree in sorted order and passes every entry
+     * to a visitor, which returns whether to descend into a directory. Each
+     * directory table is read with a single call into a buffer that is reused
+     * for all tables at the same depth, so once the buffers have grown, the
+     * walk doesn't allocate memory per entry.
+    */
+    class TreeWalker
+    {
+        public:
+            typedef std::function<bool (const EntryView&)> Visitor;
+
+            void walk (std::ifstream& file, VolumeDescriptor& vd, const Visitor& visitor);
+            void walk (std::ifstream& file, uint32_t sector, uint32_t size, const Visitor& visitor);
+
+        private:
+            void walkTable (std::ifstream& file, unsigned int depth, uint32_t sector, uint32_t size, const Visitor& visitor);
+
+            std::vector<std::vector<char> > tables;         ///< directory table by depth
+            std::vector<std::vector<uint32_t> > stacks;     ///< entry offsets left to visit by depth
+            std::string path;
+    };
 }